@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver guide stream
+ *
+ * An autoguider clears the tracking CCD, lets it integrate, reads a small
+ * region around the guide star and finds its centroid, every second or
+ * two.  IOCTL_GUIDE_STREAM does all of that in a loop in the kernel and
+ * queues a small record per cycle, so a guide loop is a poll() and a
+ * read() instead of several ioctls and a copy of the region.
+ *
+ * The port is taken as a guide command for the clear and for the read,
+ * not while the CCD integrates, so imaging readouts go on in between.
+ * The centroid is of the pixels above the mean of the region's edge,
+ * which is taken as the background; the region should be a few pixels
+ * wider than the star.  Raw pixels follow each record if asked for.
+ *
+ * guide in sysfs shows the last stream: cycles, readout errors, dropped
+ * records, how long integration overran waiting for the port, and the
+ * latency from the end of integration to the record being queued.
+ */
+
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "sbiglpt.h"
+#include "sbiglpt_module.h"
+
+void sbig_guide_init(struct sbig_device *sd)
+{
+	spin_lock_init(&sd->guide.lock);
+}
+
+void sbig_guide_open(struct sbig_client *pd)
+{
+	struct sbig_guide_queue *q = &pd->guide;
+
+	mutex_init(&q->read_lock);
+	spin_lock_init(&q->lock);
+	init_waitqueue_head(&q->wait);
+}
+
+void sbig_guide_release(struct sbig_client *pd)
+{
+	if (pd->guide.size)
+		kfifo_free(&pd->guide.fifo);
+	mutex_destroy(&pd->guide.read_lock);
+}
+
+// Start a stream, discarding records left from the last.
+int sbig_guide_begin(struct sbig_client *pd,
+		     const struct sbig_guide_stream *gs)
+{
+	struct sbig_guide_queue *q = &pd->guide;
+	struct sbig_guide *g = &pd->sd->guide;
+	u32 size = sizeof(struct sbig_guide_record);
+	int rc;
+
+	if (gs->flags & SBIG_GUIDE_RAW)
+		size += gs->gap.len * gs->gap.height * sizeof(u16);
+	if ((u64)size * gs->queue > KMALLOC_MAX_SIZE / 2)
+		return CE_BAD_PARAMETER;	// kfifo_alloc() rounds up
+	mutex_lock(&q->read_lock);
+	if (q->size)
+		kfifo_free(&q->fifo);
+	q->size = 0;
+	rc = kfifo_alloc(&q->fifo, (size_t)size * gs->queue, GFP_KERNEL);
+	if (rc == 0) {
+		spin_lock(&q->lock);
+		q->size = size;
+		q->dropped = 0;
+		q->done = false;
+		spin_unlock(&q->lock);
+		WRITE_ONCE(pd->stream, SBIG_STREAM_GUIDE);
+	}
+	mutex_unlock(&q->read_lock);
+	if (rc < 0)
+		return rc;
+
+	spin_lock(&g->lock);
+	memset(&g->st, 0, sizeof(g->st));
+	g->st.running = true;
+	spin_unlock(&g->lock);
+	return CE_NO_ERROR;
+}
+
+// Find the background, peak, flux and centroid of a region.
+void sbig_guide_centroid(const u16 *p, u32 len, u32 height,
+			 struct sbig_guide_record *r)
+{
+	u64 edge = 0, n = 0, flux = 0, sx = 0, sy = 0;
+	u32 x, y, v, bg;
+	u16 peak = 0;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < len; x++) {
+			v = p[y * len + x];
+			peak = max_t(u16, peak, v);
+			if (y > 0 && y < height - 1 && x > 0 && x < len - 1)
+				continue;
+			edge += v;
+			n++;
+		}
+	}
+	bg = div64_u64(edge, n);
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < len; x++) {
+			v = p[y * len + x];
+			if (v <= bg)
+				continue;
+			flux += v - bg;
+			sx += (u64)(v - bg) * x;
+			sy += (u64)(v - bg) * y;
+		}
+	}
+
+	r->background = bg;
+	r->peak = peak;
+	r->flux = flux;
+	if (flux == 0) {
+		r->x = r->y = -1;
+		return;
+	}
+	r->x = div64_u64(sx * 256 + flux / 2, flux);
+	r->y = div64_u64(sy * 256 + flux / 2, flux);
+}
+
+/* Queue a record, and the region's pixels if the stream asked for them,
+ * unless the queue is full.  late_ns is how long integration overran.
+ */
+void sbig_guide_push(struct sbig_client *pd, struct sbig_guide_record *r,
+		     const u16 *pixels, u64 late_ns)
+{
+	struct sbig_guide_queue *q = &pd->guide;
+	struct sbig_guide_stats *st = &pd->sd->guide.st;
+	u32 raw = q->size - sizeof(*r);
+	bool kept = kfifo_avail(&q->fifo) >= q->size;
+	u64 latency_ns;
+
+	spin_lock(&q->lock);
+	r->dropped = q->dropped;
+	q->dropped = kept ? 0 : q->dropped + 1;
+	spin_unlock(&q->lock);
+	if (kept) {
+		kfifo_in(&q->fifo, (const u8 *)r, sizeof(*r));
+		if (raw)
+			kfifo_in(&q->fifo, (const u8 *)pixels, raw);
+		wake_up_interruptible(&q->wait);
+	}
+	latency_ns = r->end_ns ? ktime_get_ns() - r->end_ns : 0;
+
+	spin_lock(&pd->sd->guide.lock);
+	st->cycles++;
+	if (r->status != CE_NO_ERROR)
+		st->errors++;
+	if (!kept)
+		st->dropped++;
+	st->late_ns += late_ns;
+	if (st->late_max_ns < late_ns)
+		st->late_max_ns = late_ns;
+	st->latency_ns += latency_ns;
+	st->latency_last_ns = latency_ns;
+	if (st->latency_max_ns < latency_ns)
+		st->latency_max_ns = latency_ns;
+	spin_unlock(&pd->sd->guide.lock);
+}
+
+void sbig_guide_end(struct sbig_client *pd)
+{
+	struct sbig_guide_queue *q = &pd->guide;
+
+	spin_lock(&q->lock);
+	q->done = true;
+	spin_unlock(&q->lock);
+	wake_up_interruptible(&q->wait);
+
+	spin_lock(&pd->sd->guide.lock);
+	pd->sd->guide.st.running = false;
+	spin_unlock(&pd->sd->guide.lock);
+}
+
+// Return the bytes of whole records queued.
+static u32 sbig_guide_queued(struct sbig_guide_queue *q)
+{
+	u32 size = READ_ONCE(q->size);
+
+	return size ? kfifo_len(&q->fifo) / size * size : 0;
+}
+
+static bool sbig_guide_readable(struct sbig_guide_queue *q)
+{
+	bool done;
+
+	spin_lock(&q->lock);
+	done = q->done;
+	spin_unlock(&q->lock);
+	return done || sbig_guide_queued(q) != 0;
+}
+
+ssize_t sbig_guide_read(struct sbig_client *pd, char __user *buf,
+			size_t count, bool nonblock)
+{
+	struct sbig_guide_queue *q = &pd->guide;
+	unsigned int copied;
+	u32 bytes;
+	bool eof;
+	ssize_t rc;
+
+	for (;;) {
+		if (!sbig_guide_readable(q)) {
+			if (nonblock)
+				return -EAGAIN;
+			if (wait_event_interruptible(q->wait,
+						     sbig_guide_readable(q)))
+				return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&q->read_lock))
+			return -ERESTARTSYS;
+		bytes = sbig_guide_queued(q);
+		spin_lock(&q->lock);
+		eof = bytes == 0 && q->done;
+		if (eof)
+			q->done = false;
+		spin_unlock(&q->lock);
+		if (bytes != 0 || eof)
+			break;
+		mutex_unlock(&q->read_lock);	// another reader got them
+	}
+
+	rc = 0;
+	if (eof)
+		goto out;
+	if (count < q->size) {
+		rc = -EINVAL;
+		goto out;
+	}
+	bytes = min_t(size_t, bytes, count / q->size * q->size);
+	rc = kfifo_to_user(&q->fifo, buf, bytes, &copied);
+	if (rc == 0) {
+		rc = copied;
+		sbig_stat_bytes(pd->sd, 0, copied);
+		sbig_status_add(pd->sd, 0, 0, 0, copied);
+	}
+out:
+	mutex_unlock(&q->read_lock);
+	return rc;
+}
+
+sbig_poll_t sbig_guide_poll(struct sbig_client *pd, struct file *file,
+			    poll_table *wait)
+{
+	struct sbig_guide_queue *q = &pd->guide;
+
+	poll_wait(file, &q->wait, wait);
+	return sbig_guide_readable(q) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static ssize_t guide_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_guide_stats t;
+
+	spin_lock(&sd->guide.lock);
+	t = sd->guide.st;
+	spin_unlock(&sd->guide.lock);
+
+	return scnprintf(buf, PAGE_SIZE,
+			 "running %d cycles %llu errors %llu dropped %llu late_mean_ns %llu late_max_ns %llu latency_last_ns %llu latency_mean_ns %llu latency_max_ns %llu\n",
+			 t.running, t.cycles, t.errors, t.dropped,
+			 t.cycles ? div64_u64(t.late_ns, t.cycles) : 0,
+			 t.late_max_ns, t.latency_last_ns,
+			 t.cycles ? div64_u64(t.latency_ns, t.cycles) : 0,
+			 t.latency_max_ns);
+}
+static DEVICE_ATTR_RO(guide);
+
+static struct attribute *sbig_guide_attrs[] = {
+	&dev_attr_guide.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_guide_group = {
+	.attrs = sbig_guide_attrs,
+};
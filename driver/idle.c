@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver idle clearing
+ *
+ * IOCTL_CLEAR_IMAG_CCD and IOCTL_CLEAR_TRAC_CCD shift the whole array
+ * out, times over, before an exposure can start.  For time critical
+ * exposures a client may ask with IOCTL_IDLE_CLEAR for a CCD to be
+ * cleared a row at a time on the readout thread while the port is idle.
+ * A clear of that CCD then stops it, and if at least as many rows went
+ * by as the clear asked for, only shifts out the last row.
+ *
+ * The readout thread takes the port for one row only when no command
+ * is waiting and no micro reply is pending, so commands are held up by
+ * a row at most.  Idle clearing must be asked for again after each
+ * exposure, as it would wipe the exposure otherwise.  Reading or
+ * dumping rows of the CCD starts the count over.
+ *
+ * idle_clear in sysfs shows the clears and how long they took from the
+ * ioctl to its return, i.e. the latency of starting an exposure.
+ * idle_clear_us is the pause between rows.
+ */
+
+#include <linux/device.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#include "sbiglpt.h"
+#include "sbiglpt_module.h"
+
+#define SBIG_IDLE_PAUSE_US	100	// default pause between rows
+
+static const char *sbig_idle_ccd_names[SBIG_IDLE_CCDS] = {
+	"imaging", "tracking",
+};
+
+void sbig_idle_init(struct sbig_device *sd)
+{
+	spin_lock_init(&sd->idle.lock);
+	sd->idle.pause_us = SBIG_IDLE_PAUSE_US;
+}
+
+int sbig_idle_arm(struct sbig_device *sd, const struct sbig_idle_clear *ic)
+{
+	struct sbig_idle *idle = &sd->idle;
+	struct sbig_client *pd;
+	int c = ic->ccd != CCD_IMAGING;
+
+	pd = kzalloc(sizeof(*pd), GFP_KERNEL);
+	if (!pd)
+		return -ENOMEM;
+	pd->sd = sd;
+	pd->port = sd->port;
+	pd->dev = sd->dev;
+
+	spin_lock(&idle->lock);
+	if (!idle->pd) {
+		idle->pd = pd;
+		pd = NULL;
+	}
+	idle->armed[c] = ic->on;
+	idle->cameraID[c] = ic->cameraID;
+	idle->swept[c] = 0;
+	spin_unlock(&idle->lock);
+	kfree(pd);
+	wake_up(&sd->worker.wait);
+	return 0;
+}
+
+bool sbig_idle_armed(struct sbig_device *sd)
+{
+	struct sbig_idle *idle = &sd->idle;
+
+	return READ_ONCE(idle->armed[0]) || READ_ONCE(idle->armed[1]);
+}
+
+// Clear a row of each armed CCD if the port is free.
+bool sbig_idle_row(struct sbig_device *sd)
+{
+	struct sbig_idle *idle = &sd->idle;
+	bool armed;
+	int c, cameraID;
+
+	if (!sbig_sched_try_idle(sd))
+		return false;
+	sd->policy = READ_ONCE(sd->readout_policy);
+	for (c = 0; c < SBIG_IDLE_CCDS; c++) {
+		spin_lock(&idle->lock);
+		armed = idle->armed[c];
+		cameraID = idle->cameraID[c];
+		spin_unlock(&idle->lock);
+		if (!armed ||
+		    KLptIdleClearRow(idle->pd, c ? CCD_TRACKING : CCD_IMAGING,
+				     cameraID) != CE_NO_ERROR)
+			continue;
+		spin_lock(&idle->lock);
+		if (idle->armed[c])
+			idle->swept[c]++;
+		idle->rows++;
+		spin_unlock(&idle->lock);
+	}
+	sbig_sched_end(idle->pd);
+	return true;
+}
+
+// Stop clearing ccd for an exposure.  Returns TRUE if rows were swept.
+bool sbig_idle_take(struct sbig_device *sd, int ccd, int cameraID, u32 rows)
+{
+	struct sbig_idle *idle = &sd->idle;
+	int c = ccd != CCD_IMAGING;
+	bool swept;
+
+	spin_lock(&idle->lock);
+	swept = idle->armed[c] && idle->cameraID[c] == cameraID &&
+		idle->swept[c] >= rows;
+	idle->armed[c] = false;
+	idle->swept[c] = 0;
+	idle->taken[c] = swept;
+	spin_unlock(&idle->lock);
+	return swept;
+}
+
+// Rows of ccd were clocked by a command, the sweep starts over.
+void sbig_idle_touch(struct sbig_device *sd, int ccd)
+{
+	struct sbig_idle *idle = &sd->idle;
+	int c = ccd != CCD_IMAGING;
+
+	if (!READ_ONCE(idle->armed[c]))
+		return;
+	spin_lock(&idle->lock);
+	idle->swept[c] = 0;
+	spin_unlock(&idle->lock);
+}
+
+// Account a clear command taking ns from ioctl to return.
+void sbig_idle_latency(struct sbig_device *sd, int ccd, u64 ns)
+{
+	struct sbig_idle *idle = &sd->idle;
+	struct sbig_idle_stats *st = &idle->stats[ccd != CCD_IMAGING];
+
+	spin_lock(&idle->lock);
+	st->clears++;
+	if (idle->taken[ccd != CCD_IMAGING])
+		st->swept++;
+	st->total_ns += ns;
+	st->last_ns = ns;
+	if (st->max_ns < ns)
+		st->max_ns = ns;
+	spin_unlock(&idle->lock);
+}
+
+void sbig_idle_free(struct sbig_device *sd)
+{
+	kfree(sd->idle.pd);
+}
+
+static ssize_t idle_clear_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_idle *idle = &sd->idle;
+	struct sbig_idle_stats st[SBIG_IDLE_CCDS];
+	bool armed[SBIG_IDLE_CCDS];
+	u64 swept[SBIG_IDLE_CCDS], rows;
+	ssize_t len = 0;
+	int c;
+
+	spin_lock(&idle->lock);
+	memcpy(st, idle->stats, sizeof(st));
+	memcpy(armed, idle->armed, sizeof(armed));
+	memcpy(swept, idle->swept, sizeof(swept));
+	rows = idle->rows;
+	spin_unlock(&idle->lock);
+
+	for (c = 0; c < SBIG_IDLE_CCDS; c++)
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%s armed %d swept %llu clears %llu shortcut %llu last_ns %llu mean_ns %llu max_ns %llu\n",
+				 sbig_idle_ccd_names[c], armed[c], swept[c],
+				 st[c].clears, st[c].swept, st[c].last_ns,
+				 st[c].clears ?
+				 div64_u64(st[c].total_ns, st[c].clears) : 0,
+				 st[c].max_ns);
+	len += scnprintf(buf + len, PAGE_SIZE - len, "rows %llu\n", rows);
+	return len;
+}
+static DEVICE_ATTR_RO(idle_clear);
+
+static ssize_t idle_clear_us_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 READ_ONCE(sd->idle.pause_us));
+}
+
+static ssize_t idle_clear_us_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	unsigned int val;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &val);
+	if (rc < 0)
+		return rc;
+	WRITE_ONCE(sd->idle.pause_us, val);
+	return count;
+}
+static DEVICE_ATTR_RW(idle_clear_us);
+
+static struct attribute *sbig_idle_attrs[] = {
+	&dev_attr_idle_clear.attr,
+	&dev_attr_idle_clear_us.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_idle_group = {
+	.attrs = sbig_idle_attrs,
+};
@@ -9,34 +9,36 @@
 //========================================================================
 
 #include <linux/slab.h>
+#include <linux/string.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/sched/signal.h>
 #include <linux/uaccess.h>
 #include <linux/device.h>
 #include <linux/parport.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
 
 #include "sbiglpt.h"
 #include "sbiglpt_module.h"
 
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
 #define HSI			0x10	// hand shake input bit
 #define CIP			0x10	// conversion in progress bit
 #define CAN			0x18	// CAN response from Micro
 #define NAK			0x15	// NAK response from Micro
 #define ACK			0x06	// ACK response from Micro
 
-#define CONVERSION_DELAY	500	// queries (approx. 1us each) before
-					// A/D must signal not busy
-
-#define VCLOCK_DELAY		10	// delays between vertical clocks
-					//  on the imaging CCD
-
-#define ST1K_VCLOCK_X		10	// multiplier for VClock an ST1K
+#define CONVERSION_TIMEOUT	500000	// ns before A/D or PLD must
+					// signal not busy
 
 #define CLEAR_BLOCK		10	// number of pixels cleared in a block
 
-#define DUMP_RATIO		5	// after every N vertical clocks
-					//  do a full horizontal clock on
+// clock delays are in pd->sd->timing, see timing.c
 
-#define IDLE_STATE_DELAY	(55*3)	// time to force idle at start of packet
+#define NIBBLE_TIMEOUT		(300 * NSEC_PER_MSEC) // max wait for micro
 
 enum output_register {
 	TRACKING_CLOCKS = 0x00,
@@ -119,6 +121,28 @@ enum readout_control_bits {
 	u += (u16)(sbig_inb(pd) & 0x78) >> 3; \
 } while (0)
 
+//========================================================================
+// KLptOpBegin
+// Count port accesses from here on as op.  Returns the previous op.
+//========================================================================
+static inline enum sbig_op KLptOpBegin(struct sbig_client *pd,
+				       enum sbig_op op)
+{
+	enum sbig_op old = pd->sd->port_op;
+
+	pd->sd->port_op = op;
+	return old;
+}
+//========================================================================
+// KLptOpEnd
+// Credit the current op with units of work done and restore old.
+//========================================================================
+static inline void KLptOpEnd(struct sbig_client *pd, enum sbig_op old,
+			     u32 units)
+{
+	sbig_stat_units(pd->sd, pd->sd->port_op, units);
+	pd->sd->port_op = old;
+}
 //========================================================================
 // KLptCameraOut
 // Write data to one of the Camera Registers.
@@ -131,9 +155,9 @@ void KLptCameraOut(struct sbig_client *pd, u8 reg, u8 val)
 	sbig_outb(pd, (reg + val));
 
 	if (reg == CONTROL_OUT)
-		pd->control_out = val;
+		pd->sd->control_out = val;
 	else if (reg == IMAGING_CLOCKS)
-		pd->imaging_clocks_out = val;
+		pd->sd->imaging_clocks_out = val;
 }
 //========================================================================
 // KLptForceMicroIdle
@@ -144,7 +168,7 @@ void KLptForceMicroIdle(struct sbig_client *pd)
 {
 	// all clocks low
 	KLptCameraOut(pd, CONTROL_OUT, 0);
-	mdelay(IDLE_STATE_DELAY);
+	sbig_wait_ms(pd, READ_ONCE(pd->sd->timing.idle_state_ms));
 }
 //========================================================================
 // KLptCameraOutWraper
@@ -185,9 +209,9 @@ u8 KLptMicroStat(struct sbig_client *pd)
 {
 	u8 val;
 
-	KLptCameraOut(pd, CONTROL_OUT, (pd->control_out | MICRO_SELECT));
+	KLptCameraOut(pd, CONTROL_OUT, (pd->sd->control_out | MICRO_SELECT));
 	val = KLptCameraIn(pd, AD3_MDI);
-	if (pd->control_out & HSO)
+	if (pd->sd->control_out & HSO)
 		return (val & HSI);
 	return ((~val) & HSI);
 }
@@ -200,10 +224,10 @@ u8 KLptMicroIn(struct sbig_client *pd, int ackIt)
 {
 	u8 val;
 
-	KLptCameraOut(pd, CONTROL_OUT, (pd->control_out | MICRO_SELECT));
+	KLptCameraOut(pd, CONTROL_OUT, (pd->sd->control_out | MICRO_SELECT));
 	val = KLptCameraIn(pd, AD3_MDI) & 0x0F;
 	if (ackIt)
-		KLptCameraOut(pd, CONTROL_OUT, (pd->control_out ^ HSO));
+		KLptCameraOut(pd, CONTROL_OUT, (pd->sd->control_out ^ HSO));
 	return val;
 }
 //========================================================================
@@ -214,7 +238,7 @@ u8 KLptMicroIn(struct sbig_client *pd, int ackIt)
 void KLptMicroOut(struct sbig_client *pd, u8 val)
 {
 	KLptCameraOut(pd, MICRO_OUT, val);
-	KLptCameraOut(pd, CONTROL_OUT, (pd->control_out ^ HSO));
+	KLptCameraOut(pd, CONTROL_OUT, (pd->sd->control_out ^ HSO));
 }
 //========================================================================
 // KLptReadyToRx
@@ -225,36 +249,22 @@ void KLptReadyToRx(struct sbig_client *pd)
 	KLptMicroOut(pd, 0); // let micro know we're ready to rx
 }
 //========================================================================
-// KLptSendMicroBlock
-// Send a block of data to the micro.
+// KLptMicroSend
+// Send length bytes at p to the micro, a nibble at a time.
 //========================================================================
-int KLptSendMicroBlock(struct sbig_client *pd, unsigned long arg)
+static int KLptMicroSend(struct sbig_client *pd, const u8 *p, u32 length)
 {
-	int status;
+	int status = CE_NO_ERROR;
 	int i, nibbleLen;
-	u8 *p = pd->buffer;
-	unsigned long t0, delay, nibbleTimeout;
-	struct linux_micro_block lmb;
-
-	// Set nibbleTimeout to 300 ms.
-	nibbleTimeout = HZ / 3;
-
-	status = copy_from_user(&lmb, (struct linux_micro_block __user *)arg,
-				sizeof(struct linux_micro_block));
-	if (status != 0) {
-		sbig_err(pd, "%s: copy_from_user: lmb error\n", __func__);
-		return -EFAULT;
-	}
-
-	status = copy_from_user(p, lmb.pBuffer, lmb.length);
-	if (status != 0) {
-		sbig_err(pd, "%s: copy_from_user: lmb.pData error\n", __func__);
-		return -EFAULT;
-	}
+	struct sbig_wait w;
+	u64 t0 = ktime_get_ns();
+	enum sbig_op op;
 
 	// caller passes bytes, we need nibbles
-	nibbleLen = lmb.length << 1;
-	t0 = jiffies;
+	nibbleLen = length << 1;
+	trace_sbig_micro_send_start(pd->sd->minor, length);
+	op = KLptOpBegin(pd, SBIG_OP_MICRO);
+	sbig_wait_start(pd, &w, NIBBLE_TIMEOUT);
 	KLptCameraOut(pd, CONTROL_OUT, MICRO_SYNC);
 
 	for (i = 0; i <= nibbleLen;) {
@@ -263,27 +273,52 @@ int KLptSendMicroBlock(struct sbig_client *pd, unsigned long arg)
 				break;
 			if (i == 1)
 				KLptCameraOut(pd, CONTROL_OUT,
-					      (pd->control_out & ~MICRO_SYNC));
+					(pd->sd->control_out & ~MICRO_SYNC));
 			if ((i % 2) == 0)
 				KLptMicroOut(pd, ((*p >> 4) & 0x0f));
 			else
 				KLptMicroOut(pd, (*p++ & 0x0f));
 			i++;
-			t0 = jiffies;
-		} else {
-			// compute time delay in milliseconds
-			delay = jiffies - t0;
-			if (delay > nibbleTimeout) {
-				status = CE_TX_TIMEOUT;
-				KLptCameraOut(pd, CONTROL_OUT, 0);
-				break;
-			}
+			sbig_wait_ready(pd, &w);
+		} else if (sbig_wait_next(pd, &w) < 0) {
+			status = CE_TX_TIMEOUT;
+			sbig_stat_timeout(pd->sd, SBIG_TIMEOUT_TX);
+			KLptCameraOut(pd, CONTROL_OUT, 0);
+			break;
 		}
 	}
 
+	KLptOpEnd(pd, op, i);
+	trace_sbig_micro_send_end(pd->sd->minor, i, status,
+				  ktime_get_ns() - t0);
 	return status;
 }
 //========================================================================
+// KLptSendMicroBlock
+// Send a block of data to the micro.
+//========================================================================
+int KLptSendMicroBlock(struct sbig_client *pd, unsigned long arg)
+{
+	int status;
+	u8 *p = pd->buffer;
+	struct linux_micro_block lmb;
+
+	status = copy_from_user(&lmb, (struct linux_micro_block __user *)arg,
+				sizeof(struct linux_micro_block));
+	if (status != 0) {
+		sbig_err(pd, "%s: copy_from_user: lmb error\n", __func__);
+		return -EFAULT;
+	}
+
+	status = copy_from_user(p, lmb.pBuffer, lmb.length);
+	if (status != 0) {
+		sbig_err(pd, "%s: copy_from_user: lmb.pData error\n", __func__);
+		return -EFAULT;
+	}
+	sbig_stat_bytes(pd->sd, lmb.length, 0);
+	return KLptMicroSend(pd, p, lmb.length);
+}
+//========================================================================
 // KLptGetMicroBlock
 // Get a block of bytes (nibbles) from the camera on the parallel port.
 //========================================================================
@@ -292,11 +327,10 @@ int KLptGetMicroBlock(struct sbig_client *pd, unsigned long arg)
 	int status;
 	int state, rx_len, cmp_len, packet_len = 0;
 	u8 *kbuf = pd->buffer, c;
-	unsigned long t0, delay, nibbleTimeout;
+	struct sbig_wait w;
 	struct linux_micro_block lmb;
-
-	// Set nibbleTimeout to 300 ms.
-	nibbleTimeout = HZ / 3;
+	u64 t0 = ktime_get_ns();
+	enum sbig_op op;
 
 	status = copy_from_user(&lmb, (struct linux_micro_block __user *)arg,
 				sizeof(struct linux_micro_block));
@@ -307,7 +341,9 @@ int KLptGetMicroBlock(struct sbig_client *pd, unsigned long arg)
 
 	state = rx_len = 0;
 	cmp_len = 2 * lmb.length;
-	t0 = jiffies;
+	trace_sbig_micro_get_start(pd->sd->minor, lmb.length);
+	op = KLptOpBegin(pd, SBIG_OP_MICRO);
+	sbig_wait_start(pd, &w, NIBBLE_TIMEOUT);
 	KLptReadyToRx(pd);
 
 	do {
@@ -366,14 +402,15 @@ int KLptGetMicroBlock(struct sbig_client *pd, unsigned long arg)
 					state++;
 				break;
 			} // switch state
-			t0 = jiffies;
-		} else {
-			// compute time delay in milliseconds
-			delay = jiffies - t0;
-			if (delay > nibbleTimeout)
-				status = CE_RX_TIMEOUT;
+			sbig_wait_ready(pd, &w);
+		} else if (sbig_wait_next(pd, &w) < 0) {
+			status = CE_RX_TIMEOUT;
+			sbig_stat_timeout(pd->sd, SBIG_TIMEOUT_RX);
 		}
 	} while ((state < 5) && (status == CE_NO_ERROR) && (rx_len < cmp_len));
+	KLptOpEnd(pd, op, rx_len);
+	trace_sbig_micro_get_end(pd->sd->minor, rx_len, status,
+				 ktime_get_ns() - t0);
 
 	if (status == CE_NO_ERROR) {
 		status = copy_to_user(lmb.pBuffer, pd->buffer, lmb.length);
@@ -382,6 +419,7 @@ int KLptGetMicroBlock(struct sbig_client *pd, unsigned long arg)
 				 __func__);
 			return -EFAULT;
 		}
+		sbig_stat_bytes(pd->sd, 0, lmb.length);
 	}
 	return status;
 }
@@ -399,7 +437,7 @@ int KLptSetVdd(struct sbig_client *pd, unsigned long arg)
 	}
 
 	// raise or lower the Vdd
-	svdd.vddWasLow = ((pd->imaging_clocks_out & TRG_H) == TRG_H);
+	svdd.vddWasLow = ((pd->sd->imaging_clocks_out & TRG_H) == TRG_H);
 	KLptCameraOut(pd, IMAGING_CLOCKS, (svdd.raiseIt ? 0 : TRG_H));
 
 	if (copy_to_user((struct ioc_set_vdd __user *)arg, &svdd,
@@ -411,32 +449,108 @@ int KLptSetVdd(struct sbig_client *pd, unsigned long arg)
 	return CE_NO_ERROR;
 }
 //========================================================================
+// KLptAtomicBegin
+// Enter a section the readout policy says must not be interrupted.
+//========================================================================
+static void KLptAtomicBegin(struct sbig_client *pd)
+{
+	struct sbig_device *sd = pd->sd;
+
+	if (sd->atomic_depth++ > 0)
+		return;
+	if (sd->policy == SBIG_POLICY_IRQ)
+		local_irq_save(sd->irq_flags);
+	else
+		preempt_disable();
+	sd->atomic_t0 = ktime_get_ns();
+}
+//========================================================================
+// KLptAtomicEnd
+//========================================================================
+static void KLptAtomicEnd(struct sbig_client *pd)
+{
+	struct sbig_device *sd = pd->sd;
+
+	if (--sd->atomic_depth > 0)
+		return;
+	sbig_atomic_account(sd, ktime_get_ns() - sd->atomic_t0);
+	if (sd->policy == SBIG_POLICY_IRQ)
+		local_irq_restore(sd->irq_flags);
+	else
+		preempt_enable();
+}
+//========================================================================
 // KDisable
-// Disable interrupts.
+// Protect a CCD clock sequence (vertical transfer, pipeline fill).
+// Disables preemption or local interrupts, depending on policy.
 //========================================================================
 void KDisable(struct sbig_client *pd)
 {
-	//__save_flags(pd->flags);
-	// we should disable only certain types of interrupts,
-	// stopping all we freeze the system including system clock
-	//__cli();
+	if (pd->sd->policy != SBIG_POLICY_PREEMPT)
+		KLptAtomicBegin(pd);
 }
 //========================================================================
 // KEnable
-// Enable interrupts.
 //========================================================================
 void KEnable(struct sbig_client *pd)
 {
-	//__restore_flags(pd->flags);
+	if (pd->sd->policy != SBIG_POLICY_PREEMPT)
+		KLptAtomicEnd(pd);
+}
+//========================================================================
+// KDisableRow
+// Protect a whole row readout, if the policy calls for it.
+//========================================================================
+static void KDisableRow(struct sbig_client *pd)
+{
+	if (pd->sd->policy == SBIG_POLICY_ROW)
+		KLptAtomicBegin(pd);
+}
+//========================================================================
+// KEnableRow
+//========================================================================
+static void KEnableRow(struct sbig_client *pd)
+{
+	if (pd->sd->policy == SBIG_POLICY_ROW)
+		KLptAtomicEnd(pd);
 }
 //========================================================================
 // KLptIoDelay
-// Delay a passed number of IO instructions.
+// Delay a passed number of nanoseconds.  One port read is always done
+// so the preceding write has reached the port before timing starts.
+//========================================================================
+void KLptIoDelay(struct sbig_client *pd, unsigned int ns)
+{
+	unsigned int read_ns = pd->sd->io_read_ns;
+	int i;
+
+	sbig_stat_busy(pd->sd, SBIG_BUSY_DELAY, ns);
+	if (pd->sd->io_delay_reads) {
+		for (i = DIV_ROUND_UP(ns, read_ns); i > 0; i--)
+			sbig_inb(pd);
+		return;
+	}
+	sbig_inb(pd);
+	if (ns <= read_ns)
+		return;
+	ns -= read_ns;
+	if (ns >= NSEC_PER_USEC)
+		udelay(ns / NSEC_PER_USEC);
+	ndelay(ns % NSEC_PER_USEC);
+}
+//========================================================================
+// KLptPollDone
+// Account for a wait that took the passed number of polls.
 //========================================================================
-void KLptIoDelay(struct sbig_client *pd, int i)
+static inline void KLptPollDone(struct sbig_poll_stats *st,
+				unsigned int polls)
 {
-	for (; i > 0; i--)
-		sbig_inb(pd);
+	st->waits++;
+	st->polls += polls;
+	if (st->max_polls < polls)
+		st->max_polls = polls;
+	if (st->min_polls > polls || st->min_polls == 0)
+		st->min_polls = polls;
 }
 //========================================================================
 // KLptWaitForPLD
@@ -444,32 +558,106 @@ void KLptIoDelay(struct sbig_client *pd, int i)
 //========================================================================
 int KLptWaitForPLD(struct sbig_client *pd)
 {
-	int t0 = 0;
-
-	while (1) {
-		if (!(KLptCameraIn(pd, AD0) & CIP))
-			break;
-		if (t0++ >= CONVERSION_DELAY)
+	struct sbig_poll_stats *st = &pd->sd->pld_polls;
+	unsigned int polls = 1;
+	u64 deadline = 0;
+	u64 t0 = 0;
+
+	if (trace_sbig_pld_wait_enabled())
+		t0 = ktime_get_ns();
+	// the clock is only read if the first poll fails
+	while (KLptCameraIn(pd, AD0) & CIP) {
+		if (deadline == 0) {
+			deadline = ktime_get_ns() + CONVERSION_TIMEOUT;
+		} else if (ktime_get_ns() > deadline) {
+			st->timeouts++;
+			sbig_stat_timeout(pd->sd, SBIG_TIMEOUT_PLD);
+			if (t0)
+				trace_sbig_pld_wait(pd->sd->minor, polls,
+						    ktime_get_ns() - t0, true);
+			return CE_AD_TIMEOUT;
+		}
+		polls++;
+	}
+	KLptPollDone(st, polls);
+	sbig_stat_busy(pd->sd, SBIG_BUSY_PLD, polls * pd->sd->io_read_ns);
+	if (t0)
+		trace_sbig_pld_wait(pd->sd->minor, polls, ktime_get_ns() - t0,
+				    false);
+	return CE_NO_ERROR;
+}
+//========================================================================
+// KLptPollAD
+// Poll until the A/D signals complete.  Assumes AD0 is addressed.
+// If adaptive settling is on, first wait out the part of a conversion
+// that has always been found still busy.
+//========================================================================
+static inline int KLptPollAD(struct sbig_client *pd)
+{
+	struct sbig_poll_stats *st = &pd->sd->ad_polls;
+	unsigned int polls = 1;
+	u64 deadline = 0;
+	u64 t0 = 0;
+
+	if (trace_sbig_ad_wait_enabled())
+		t0 = ktime_get_ns();
+	if (pd->sd->ad_settle_ns)
+		ndelay(pd->sd->ad_settle_ns);
+	while (sbig_inb(pd) & 0x80) {
+		if (deadline == 0) {
+			deadline = ktime_get_ns() + CONVERSION_TIMEOUT;
+		} else if (ktime_get_ns() > deadline) {
+			st->timeouts++;
+			sbig_stat_timeout(pd->sd, SBIG_TIMEOUT_AD);
+			if (t0)
+				trace_sbig_ad_wait(pd->sd->minor, polls,
+						   ktime_get_ns() - t0, true);
 			return CE_AD_TIMEOUT;
+		}
+		polls++;
 	}
+	KLptPollDone(st, polls);
+	sbig_stat_busy(pd->sd, SBIG_BUSY_AD, polls * pd->sd->io_read_ns);
+	if (t0)
+		trace_sbig_ad_wait(pd->sd->minor, polls, ktime_get_ns() - t0,
+				   false);
+	if (pd->sd->ad_readout_min > polls)
+		pd->sd->ad_readout_min = polls;
 	return CE_NO_ERROR;
 }
 //========================================================================
+// KLptAdaptSettle
+// Called at the start and end of a readout.  Grow the settle time by
+// the polls every conversion of the last readout needed; if none was
+// found busy, shrink it a little to probe for a faster A/D.
+//========================================================================
+static void KLptAdaptSettle(struct sbig_client *pd, bool start)
+{
+	struct sbig_device *sd = pd->sd;
+	unsigned int min = sd->ad_readout_min;
+
+	sd->ad_readout_min = UINT_MAX;
+	if (start || min == UINT_MAX)
+		return;
+	if (!sd->ad_adaptive) {
+		sd->ad_settle_ns = 0;
+		return;
+	}
+	if (min > 1)
+		sd->ad_settle_ns += (min - 1) * sd->io_read_ns;
+	else if (sd->ad_settle_ns >= sd->io_read_ns)
+		sd->ad_settle_ns -= sd->io_read_ns;
+	if (sd->ad_settle_ns > CONVERSION_TIMEOUT / 2)
+		sd->ad_settle_ns = CONVERSION_TIMEOUT / 2;
+}
+//========================================================================
 // KLptWaitForAD
 // Wait till the AD signals complete.
 //========================================================================
 int KLptWaitForAD(struct sbig_client *pd)
 {
-	int t0 = 0;
-
 	sbig_outb(pd, AD0);
-	while (1) {
-		if (!(sbig_inb(pd) & 0x80))
-			break;
-		if (t0++ >= CONVERSION_DELAY)
-			return CE_AD_TIMEOUT;
-	}
-	return CE_NO_ERROR;
+	return KLptPollAD(pd);
 }
 //========================================================================
 // KLptHClear
@@ -477,9 +665,11 @@ int KLptWaitForAD(struct sbig_client *pd)
 //========================================================================
 int KLptHClear(struct sbig_client *pd, int times)
 {
-	int status;
+	enum sbig_op op = KLptOpBegin(pd, SBIG_OP_CLEAR);
+	int status = CE_NO_ERROR;
+	int i;
 
-	for (; times > 0; times--) {
+	for (i = 0; i < times; i++) {
 		// shift CLEAR_BLOCK horizontally
 		KLptCameraOut(pd, CONTROL_OUT, IMAGING_SELECT + AD_TRIGGER);
 		KLptCameraOut(pd, CONTROL_OUT, IMAGING_SELECT);
@@ -487,9 +677,10 @@ int KLptHClear(struct sbig_client *pd, int times)
 		// wait for PLD
 		status = KLptWaitForPLD(pd);
 		if (status != CE_NO_ERROR)
-			return status;
+			break;
 	}
-	return CE_NO_ERROR;
+	KLptOpEnd(pd, op, i);
+	return status;
 }
 //========================================================================
 // KLptRVClockST5CCCD
@@ -499,6 +690,7 @@ int KLptRVClockST5CCCD(struct sbig_client *pd,
 		       struct ioc_vclock_ccd_params *pParams)
 {
 	int i, onVertBin = pParams->onVertBin;
+	enum sbig_op op = KLptOpBegin(pd, SBIG_OP_VCLOCK);
 
 	// no clear of the serial register is required since when not addressing
 	// the CCD the SRG is left low in the low dark current state
@@ -515,6 +707,7 @@ int KLptRVClockST5CCCD(struct sbig_client *pd,
 	}
 	KLptCameraOut(pd, IMAGING_CLOCKS, 0); // all clocks low
 	KEnable(pd);
+	KLptOpEnd(pd, op, onVertBin);
 	return CE_NO_ERROR;
 }
 //========================================================================
@@ -525,6 +718,7 @@ int KLptRVClockTrackingCCD(struct sbig_client *pd,
 			   struct ioc_vclock_ccd_params *pParams)
 {
 	int i, onVertBin = pParams->onVertBin;
+	enum sbig_op op = KLptOpBegin(pd, SBIG_OP_VCLOCK);
 
 	// no clear of the serial register is required since when not addressing
 	// the CCD the SRG is left low in the low dark current state
@@ -552,6 +746,7 @@ int KLptRVClockTrackingCCD(struct sbig_client *pd,
 	KLptCameraOut(pd, TRACKING_CLOCKS, TABG_M + CLR); // both low
 	KLptCameraOut(pd, TRACKING_CLOCKS, 0); // all clocks low
 	KEnable(pd);
+	KLptOpEnd(pd, op, onVertBin);
 	return CE_NO_ERROR;
 }
 //========================================================================
@@ -563,9 +758,11 @@ int KLptVClockImagingCCD(struct sbig_client *pd, enum camera_type cameraID,
 {
 	int status;
 	u8 v1_h, v2_h;
-	int vclock_delay = (cameraID == ST1K_CAMERA
-				? ST1K_VCLOCK_X * VCLOCK_DELAY : VCLOCK_DELAY);
+	unsigned int vclock_delay = READ_ONCE(pd->sd->timing.vclock_delay_ns);
+	enum sbig_op op = KLptOpBegin(pd, SBIG_OP_VCLOCK);
 
+	if (cameraID == ST1K_CAMERA)
+		vclock_delay *= READ_ONCE(pd->sd->timing.st1k_vclock_x);
 	if (cameraID == ST10_CAMERA) {
 		v1_h = V2_H;
 		v2_h = V1_H;
@@ -601,8 +798,10 @@ int KLptVClockImagingCCD(struct sbig_client *pd, enum camera_type cameraID,
 		KLptCameraOut(pd, IMAGING_CLOCKS, (baseClks)); // all low
 		KLptIoDelay(pd, vclock_delay);
 	}
+	KLptOpEnd(pd, op, 1);
 	return CE_NO_ERROR;
 out:
+	KLptOpEnd(pd, op, 0);
 	pd->last_error = status;
 	return status;
 }
@@ -617,7 +816,11 @@ int KLptBlockClearPixels(struct sbig_client *pd, enum camera_type cameraID,
 	int status;
 	int j, bulk, individual;
 	u8 ccd_select;
+	u64 t0 = 0;
+	enum sbig_op op = KLptOpBegin(pd, SBIG_OP_CLEAR);
 
+	if (trace_sbig_block_clear_enabled())
+		t0 = ktime_get_ns();
 	ccd_select = (ccd == CCD_IMAGING ? IMAGING_SELECT : TRACKING_SELECT);
 
 	// clear pixels in groups of CLEAR_BLOCK which is supported by
@@ -665,8 +868,13 @@ int KLptBlockClearPixels(struct sbig_client *pd, enum camera_type cameraID,
 		if (status != CE_NO_ERROR)
 			goto out;
 	}
+	if (t0)
+		trace_sbig_block_clear(pd->sd->minor, ccd, len,
+				       ktime_get_ns() - t0);
+	KLptOpEnd(pd, op, bulk + individual);
 	return CE_NO_ERROR;
 out:
+	KLptOpEnd(pd, op, 0);
 	pd->last_error = status;
 	return status;
 }
@@ -702,79 +910,144 @@ out:
 	return status;
 }
 //========================================================================
-// KLptGetPixels
+// KLptProgress
+// Publish progress of a command that works in rows.
+//========================================================================
+static void KLptProgress(struct sbig_client *pd, u32 nr, u32 row, u32 total)
+{
+	struct sbig_device *sd = pd->sd;
+
+	WRITE_ONCE(sd->progress_total, total);
+	WRITE_ONCE(sd->progress_row, row);
+	WRITE_ONCE(sd->progress_cmd, nr);
+	sbig_status_progress(sd, nr, row, total);
+}
+//========================================================================
+// KLptRowDone
+// Call between rows.  Returns < 0 if the command should be abandoned
+// because the device is going away, IOCTL_CANCEL or a fatal signal.
+// The camera must be left with nothing half clocked at this point.
+//========================================================================
+static int KLptRowDone(struct sbig_client *pd, u32 row)
+{
+	struct sbig_device *sd = pd->sd;
+
+	WRITE_ONCE(sd->progress_row, row);
+	sbig_status_row(sd, row);
+	sbig_rec_pause(sd);
+	if (READ_ONCE(sd->sched.dead))
+		return -ENODEV;
+	if (atomic_read(&pd->cancel_seq) != pd->cancel_start)
+		return -ECANCELED;
+	if (sbig_worker_current(sd) ? READ_ONCE(pd->killed)
+				    : fatal_signal_pending(current))
+		return -EINTR;
+	return 0;
+}
+//========================================================================
+// KLptFlushSerial
+// Empty the serial register of an abandoned readout, leaving the
+// clocks idle.  The application clears the array before the next
+// exposure as usual.
+//========================================================================
+static void KLptFlushSerial(struct sbig_client *pd,
+			    enum camera_type cameraID, enum ccd_request ccd,
+			    int width)
+{
+	KLptBlockClearPixels(pd, cameraID, ccd, CLEAR_BLOCK *
+			     ((width + CLEAR_BLOCK - 1) / CLEAR_BLOCK), 0);
+}
+//========================================================================
+// KLptRowClears
+// Number of PLD clears KLptReadRow does around the pixels it digitizes,
+// the right ones only if it doesn't merge them into the next row's.
+//========================================================================
+static u32 KLptRowClears(const struct ioc_get_area_params *gap, bool merged)
+{
+	u32 left = max_t(int, gap->left, 0);
+	u32 right = max_t(int, gap->right, 0);
+
+	return left / CLEAR_BLOCK + left % CLEAR_BLOCK + 2 +
+		(merged ? 0 : DIV_ROUND_UP(right, CLEAR_BLOCK));
+}
+//========================================================================
+// KLptMergeClears
+// Return TRUE if the pixels right of a row can be left for the vertical
+// clock of the next, which clears clearWidth pixels first anyway.
+//========================================================================
+static bool KLptMergeClears(struct sbig_device *sd,
+			    const struct ioc_get_area_params *gap)
+{
+	return READ_ONCE(sd->timing.merge_clears) && gap->right > 0 &&
+		gap->ccd == CCD_IMAGING && gap->cameraID != ST5C_CAMERA &&
+		gap->cameraID != ST237_CAMERA &&
+		gap->clearWidth >= gap->right * max_t(int, gap->horzBin, 1);
+}
+//========================================================================
+// KLptReadRow
 // Get a row of pixels, discarding any on the left, digitizing len,
-// discarding on the right.
+// discarding on the right.  The height in gap is not used, row is only
+// for tracing.  more says the next command is another KLptReadRow.
 //========================================================================
-int KLptGetPixels(struct sbig_client *pd, unsigned long arg)
+static int KLptReadRow(struct sbig_client *pd,
+		       const struct ioc_get_area_params *gap, int row, u16 *p,
+		       bool more)
 {
 	int status;
-	struct linux_get_pixels_params lgpp;
 	struct ioc_vclock_ccd_params ivcp;
-	enum camera_type cameraID;
-	enum ccd_request ccd;
+	enum camera_type cameraID = gap->cameraID;
+	enum ccd_request ccd = gap->ccd;
 	u16 u = 0;
 	u16 mask;
 	u8 ccd_select;
-	int i, left, len, right, horzBin, st237A;
-	u16 *kbuf = (u16 *)(pd->buffer);
-
-	status = copy_from_user(&lgpp,
-				(struct linux_get_pixels_params __user *)arg,
-				sizeof(struct linux_get_pixels_params));
-	if (status != 0) {
-		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
-		return -EFAULT;
-	}
-
-	// init vars
-	cameraID = lgpp.gpp.cameraID;
-	ccd = lgpp.gpp.ccd;
-	left = lgpp.gpp.left;
-	len = lgpp.gpp.len;
-	right = lgpp.gpp.right;
-	horzBin = lgpp.gpp.horzBin;
-	st237A = lgpp.gpp.st237A;
+	int j;
+	u64 t0 = ktime_get_ns();
+	u64 t1, t2, t3, t4;
+	enum sbig_op op = pd->sd->port_op;
+	bool jitter = pd->jitter_active;
+	u64 tj = 0, jitter_ns = 0;
+	bool merged = more && KLptMergeClears(pd->sd, gap);
+	u32 blocks;
 
-	if (lgpp.length < (unsigned long)(2L * len))
-		return CE_BAD_PARAMETER;
-
-	mask = (cameraID == ST237_CAMERA && !st237A) ? 0x0FFF : 0xFFFF;
+	ivcp.cameraID = cameraID;
+	ivcp.clearWidth = gap->clearWidth;
+	ivcp.onVertBin = gap->vertBin;
+	mask = (cameraID == ST237_CAMERA && !gap->st237A) ? 0x0FFF : 0xFFFF;
+	ccd_select = (ccd == CCD_IMAGING ? IMAGING_SELECT : TRACKING_SELECT);
 
-	// disable interrupts
-	KDisable(pd);
+	trace_sbig_row_start(pd->sd->minor, gap, row);
+	sbig_idle_touch(pd->sd, ccd);
+	KDisableRow(pd);
 
 	// do a vertical clock
-	ivcp.cameraID = cameraID;
-	ivcp.clearWidth = lgpp.gpp.clearWidth;
-	ivcp.onVertBin = lgpp.gpp.vertBin;
-
 	if (cameraID == ST5C_CAMERA || cameraID == ST237_CAMERA)
 		KLptRVClockST5CCCD(pd, &ivcp);
 	else if (ccd == CCD_IMAGING)
 		KLptRVClockImagingCCD(pd, &ivcp);
 	else
 		KLptRVClockTrackingCCD(pd, &ivcp);
+	t1 = ktime_get_ns();
+	trace_sbig_vclock(pd->sd->minor, ccd, gap->vertBin, t1 - t0);
 
 	// discard unused pixels on left and fill pipeline
 	// using the block clear function
-	ccd_select = (ccd == CCD_IMAGING ? IMAGING_SELECT : TRACKING_SELECT);
-	if (left != 0) {
-		status = KLptBlockClearPixels(pd, cameraID, ccd, left, 0);
-		if  (status != CE_NO_ERROR) {
-			KEnable(pd);
-			return status;
-		}
+	if (gap->left != 0) {
+		status = KLptBlockClearPixels(pd, cameraID, ccd, gap->left, 0);
+		if (status != CE_NO_ERROR)
+			goto out;
 	}
 
-	status = KLptBlockClearPixels(pd, cameraID, ccd, 2, horzBin - 1);
+	KDisable(pd);
+	status = KLptBlockClearPixels(pd, cameraID, ccd, 2, gap->horzBin - 1);
 	if (status != CE_NO_ERROR) {
 		KEnable(pd);
-		return status;
+		goto out;
 	}
 
 	// Digitize desired pixels
-	switch (horzBin) {
+	t2 = ktime_get_ns();
+	op = KLptOpBegin(pd, SBIG_OP_DIGITIZE);
+	switch (gap->horzBin) {
 	case 2:
 		KLptCameraOut(pd, TRACKING_CLOCKS, BIN);
 		break;
@@ -788,50 +1061,141 @@ int KLptGetPixels(struct sbig_client *pd, unsigned long arg)
 
 	KLptCameraOut(pd, CONTROL_OUT, ccd_select); // select desired CCD
 	sbig_outb(pd, AD0); // address done bit
+	KEnable(pd);
 
-	for (i = 0; i < len; i++) {
-		// optimize as non-subroutine for Speed
-		u = CONVERSION_DELAY;
-		while (1) {
-			if (!(sbig_inb(pd) & 0x80))
-				break;
-			if (--u == 0) {
-				KEnable(pd);
-				return CE_AD_TIMEOUT;
-			}
+	for (j = 0; j < gap->len; j++) {
+		if (KLptPollAD(pd) != CE_NO_ERROR) {
+			status = CE_AD_TIMEOUT;
+			goto out;
 		}
-
 		// trigger A/D for next cycle
-		KLptCameraOut(pd, CONTROL_OUT, (ccd_select + AD_TRIGGER));
+		KLptCameraOut(pd, CONTROL_OUT, ccd_select + AD_TRIGGER);
+		if (jitter)
+			sbig_jitter_pixel(pd, &tj, &jitter_ns);
 		KLptCameraOut(pd, CONTROL_OUT, ccd_select);
 		K_LPT_READ_AD16(pd, u);
 		u &= mask;
-		*kbuf++ = u;
+		*p++ = u;
 	}
 
-	KEnable(pd);
+	KEnableRow(pd);
 
 	// wait for last A/D
 	status = KLptWaitForAD(pd);
 	if (status != CE_NO_ERROR)
-		return status;
+		goto out_trace;
+	KLptOpEnd(pd, op, gap->len);
+	t3 = ktime_get_ns();
+	if (jitter && sbig_jitter_row(pd, row, jitter_ns))
+		trace_sbig_row_jitter(pd->sd->minor, row, jitter_ns);
+
+	// discard unused right pixels, or leave them to the next row
+	if (merged) {
+		blocks = DIV_ROUND_UP(gap->right, CLEAR_BLOCK);
+		sbig_timing_merged(pd->sd, row == 0, blocks, 3 + 2 * blocks,
+				   sbig_model_predict(pd->sd, 0, 0, blocks, 0));
+	} else if (gap->right != 0) {
+		KLptBlockClearPixels(pd, cameraID, ccd, CLEAR_BLOCK *
+			((gap->right + CLEAR_BLOCK - 1) / CLEAR_BLOCK), 0);
+	}
+	t4 = ktime_get_ns();
+	sbig_model_row(pd->sd, ccd != CCD_IMAGING, gap->vertBin, t1 - t0,
+		       KLptRowClears(gap, merged), (t2 - t1) + (t4 - t3),
+		       gap->len, t3 - t2);
+	sbig_row_account(pd->sd, t4 - t0);
+	sbig_status_add(pd->sd, 0, 1, gap->len, 0);
+	trace_sbig_row_end(pd->sd->minor, row, CE_NO_ERROR);
+	return CE_NO_ERROR;
+out:
+	KEnableRow(pd);
+out_trace:
+	pd->sd->port_op = op;
+	trace_sbig_row_end(pd->sd->minor, row, status);
+	return status;
+}
+//========================================================================
+// KLptGetPixels
+// Get a row of pixels, discarding any on the left, digitizing len,
+// discarding on the right.
+//========================================================================
+int KLptGetPixels(struct sbig_client *pd, unsigned long arg)
+{
+	int status;
+	struct linux_get_pixels_params lgpp;
+	struct ioc_get_area_params gap;
 
-	// discard unused right pixels
-	if (right != 0) {
-		status = KLptBlockClearPixels(pd, cameraID, ccd,
-				(CLEAR_BLOCK * ((right + CLEAR_BLOCK - 1)
-				/ CLEAR_BLOCK)), 0);
+	status = copy_from_user(&lgpp,
+				(struct linux_get_pixels_params __user *)arg,
+				sizeof(struct linux_get_pixels_params));
+	if (status != 0) {
+		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
+		return -EFAULT;
 	}
 
+	if (lgpp.length < (unsigned long)(2L * lgpp.gpp.len))
+		return CE_BAD_PARAMETER;
+	if (pd->buffer_size < lgpp.length)
+		return CE_BAD_PARAMETER;
+
+	gap.cameraID = lgpp.gpp.cameraID;
+	gap.ccd = lgpp.gpp.ccd;
+	gap.left = lgpp.gpp.left;
+	gap.len = lgpp.gpp.len;
+	gap.right = lgpp.gpp.right;
+	gap.horzBin = lgpp.gpp.horzBin;
+	gap.vertBin = lgpp.gpp.vertBin;
+	gap.clearWidth = lgpp.gpp.clearWidth;
+	gap.st237A = lgpp.gpp.st237A;
+	gap.height = 1;
+
+	KLptAdaptSettle(pd, true);
+	status = KLptReadRow(pd, &gap, 0, (u16 *)pd->buffer, false);
+	KLptAdaptSettle(pd, false);
+	if (status != CE_NO_ERROR)
+		return status;
+
 	status = copy_to_user(lgpp.dest, pd->buffer, lgpp.length);
 	if (status != 0) {
 		sbig_err(pd, "%s: copy_to_user: lgpp.dest error\n", __func__);
 		return -EFAULT;
 	}
+	sbig_stat_bytes(pd->sd, 0, lgpp.length);
+	sbig_status_add(pd->sd, 0, 0, 0, lgpp.length);
 
 	return status;
 }
 //========================================================================
+// KLptPredictArea
+// Predict the port time of KLptGetArea, 0 if unknown.
+//========================================================================
+static u64 KLptPredictArea(struct sbig_device *sd,
+			   const struct ioc_get_area_params *gap)
+{
+	u32 clears;
+
+	if (gap->height <= 0 || gap->len < 0 || gap->vertBin < 0)
+		return 0;
+	clears = KLptRowClears(gap, false);
+	if (KLptMergeClears(sd, gap))
+		clears += KLptRowClears(gap, true) * (gap->height - 1);
+	else
+		clears *= gap->height;
+	return sbig_model_predict(sd, gap->ccd != CCD_IMAGING,
+				  gap->vertBin * gap->height, clears,
+				  gap->len * gap->height);
+}
+//========================================================================
+// KLptAccumRow
+// Add a row to the sums of IOCTL_ACCUMULATE.
+//========================================================================
+static void KLptAccumRow(u32 *sum, const u16 *p, int len)
+{
+	int j;
+
+	for (j = 0; j < len; j++)
+		sum[j] += p[j];
+}
+//========================================================================
 // KLptGetArea
 // Get one or more rows of pixel data.
 //========================================================================
@@ -839,15 +1203,12 @@ int KLptGetArea(struct sbig_client *pd, unsigned long arg)
 {
 	int status;
 	struct linux_get_area_params lgap;
-	struct ioc_vclock_ccd_params ivcp;
 	enum camera_type cameraID;
-	enum ccd_request ccd;
-	u16 u = 0;
-	u16 mask;
-	u8 ccd_select;
-	int i, j, left, len, right, horzBin, height;
+	int i, len, height;
 	u16 *kbuf = (u16 *)(pd->buffer);
-	u16 *p;
+	u16 *row;
+	u64 t0, port_ns = 0, predicted_ns;
+	bool accum;
 
 	status = copy_from_user(&lgap,
 				(struct linux_get_area_params __user *)arg,
@@ -859,106 +1220,63 @@ int KLptGetArea(struct sbig_client *pd, unsigned long arg)
 
 	// init variables
 	cameraID = lgap.gap.cameraID;
-	ccd = lgap.gap.ccd;
-	left = lgap.gap.left;
 	len = lgap.gap.len;
-	right = lgap.gap.right;
-	horzBin = lgap.gap.horzBin;
 	height = lgap.gap.height;
-	ivcp.cameraID = cameraID;
-	ivcp.clearWidth = lgap.gap.clearWidth;
-	ivcp.onVertBin = lgap.gap.vertBin;
-	mask = (cameraID == ST237_CAMERA && !lgap.gap.st237A) ? 0x0FFF : 0xFFFF;
 
-	// check input parameters
-	if (lgap.length != (unsigned long)height * len * 2)
-		return CE_BAD_PARAMETER;
-	// check if internal data buffer is long enough
-	if (pd->buffer_size < (unsigned long)height * len * 2)
-		return CE_BAD_PARAMETER;
+	// summing rows only needs a row buffer, see KLptAccumulate
+	accum = pd->accum &&
+		memcmp(&lgap.gap, &pd->accum_gap, sizeof(lgap.gap)) == 0;
+	if (accum) {
+		if (pd->accum_frames == SBIG_ACCUM_MAX_FRAMES ||
+		    pd->buffer_size < len * 2)
+			return CE_BAD_PARAMETER;
+	} else {
+		// check input parameters
+		if (lgap.length != (unsigned long)height * len * 2)
+			return CE_BAD_PARAMETER;
+		// check if internal data buffer is long enough
+		if (pd->buffer_size < (unsigned long)height * len * 2)
+			return CE_BAD_PARAMETER;
+	}
+	KLptAdaptSettle(pd, true);
+	KLptProgress(pd, _IOC_NR(IOCTL_GET_AREA), 0, height);
+	sbig_jitter_begin(pd);
+	predicted_ns = KLptPredictArea(pd->sd, &lgap.gap);
 	for (i = 0; i < height; i++) {
-		// set actual buffer position
-		p = kbuf + i * 2 * len;
-
-		KDisable(pd);
-
-		// do a vertical clock
-		if (cameraID == ST5C_CAMERA || cameraID == ST237_CAMERA)
-			KLptRVClockST5CCCD(pd, &ivcp);
-		else if (ccd == CCD_IMAGING)
-			KLptRVClockImagingCCD(pd, &ivcp);
-		else
-			KLptRVClockTrackingCCD(pd, &ivcp);
-
-		// discard unused pixels on left and fill pipeline
-		// using the block clear function
-		ccd_select =
-			(ccd == CCD_IMAGING ? IMAGING_SELECT : TRACKING_SELECT);
-		if (left != 0) {
-			status = KLptBlockClearPixels(pd, cameraID,
-						      ccd, left, 0);
-			if (status != CE_NO_ERROR) {
-				KEnable(pd);
-				return status;
-			}
-		}
-
-		status = KLptBlockClearPixels(pd, cameraID, ccd, 2,
-					      horzBin - 1);
-		if (status != CE_NO_ERROR) {
-			KEnable(pd);
-			return status;
-		}
-
-		// Digitize desired pixels
-		switch (horzBin) {
-		case 2:
-			KLptCameraOut(pd, TRACKING_CLOCKS, BIN);
-			break;
-		case 3:
-			KLptCameraOut(pd, TRACKING_CLOCKS, BIN + CLR);
-			break;
-		default:
-			KLptCameraOut(pd, TRACKING_CLOCKS, 0);
-			break;
-		}
-
-		KLptCameraOut(pd, CONTROL_OUT,
-			      ccd_select); // select desired CCD
-		sbig_outb(pd, AD0); // address done bit
-
-		for (j = 0; j < len; j++) {
-			// optimize as non-subroutine for Speed
-			u = CONVERSION_DELAY;
-			while (1) {
-				if (!(sbig_inb(pd) & 0x80))
-					break;
-				if (--u == 0) {
-					KEnable(pd);
-					return CE_AD_TIMEOUT;
-				}
-			}
-			// trigger A/D for next cycle
-			KLptCameraOut(pd, CONTROL_OUT, ccd_select + AD_TRIGGER);
-			KLptCameraOut(pd, CONTROL_OUT, ccd_select);
-			K_LPT_READ_AD16(pd, u);
-			u &= mask;
-			*p++ = u;
-		}
-
-		KEnable(pd);
-
-		// wait for last A/D
-		status = KLptWaitForAD(pd);
+		row = accum ? kbuf : kbuf + i * len;
+		t0 = ktime_get_ns();
+		status = KLptReadRow(pd, &lgap.gap, i, row, i + 1 < height);
+		port_ns += ktime_get_ns() - t0;
 		if (status != CE_NO_ERROR)
-			return status;
+			goto out;
+		if (accum)
+			KLptAccumRow(pd->accum + i * len, row, len);
+		status = KLptRowDone(pd, i + 1);
+		if (status < 0) {
+			KLptFlushSerial(pd, cameraID, lgap.gap.ccd,
+					lgap.gap.clearWidth);
+			goto out;
+		}
 
-		// discard unused right pixels
-		if (right != 0) {
-			status = KLptBlockClearPixels(
-				pd, cameraID, ccd, CLEAR_BLOCK *
-				  ((right + CLEAR_BLOCK - 1) / CLEAR_BLOCK), 0);
+		// Let guide transactions in between rows.  The serial register
+		// is cleared before the next vertical clock, and cameras with
+		// a separate tracking CCD don't disturb the imaging array.
+		if (lgap.gap.ccd == CCD_IMAGING && cameraID != ST5C_CAMERA &&
+		    cameraID != ST237_CAMERA) {
+			status = sbig_sched_yield(pd, SBIG_CLASS_IMAGING);
+			if (status < 0)
+				goto out;
 		}
+		cond_resched();
+	}
+	sbig_jitter_end(pd, CE_NO_ERROR);
+	sbig_model_error(pd->sd, predicted_ns, port_ns);
+
+	KLptAdaptSettle(pd, false);
+	if (accum) {
+		pd->accum_frames++;
+		sbig_status_add(pd->sd, 1, 0, 0, 0);
+		return CE_NO_ERROR;
 	}
 
 	// copy area back to the user space
@@ -967,23 +1285,192 @@ int KLptGetArea(struct sbig_client *pd, unsigned long arg)
 		sbig_err(pd, "%s: copy_to_user: lgap.dest error\n", __func__);
 		return -EFAULT;
 	}
+	sbig_stat_bytes(pd->sd, 0, lgap.length);
+	sbig_status_add(pd->sd, 1, 0, 0, lgap.length);
 
 	return CE_NO_ERROR;
+out:
+	sbig_jitter_end(pd, status);
+	return status;
 }
 //========================================================================
-// KLptDumpImagingLines
+// KLptSqrt
+//========================================================================
+static u32 KLptSqrt(u64 x)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
+	return int_sqrt64(x);
+#else
+	return int_sqrt(min_t(u64, x, ULONG_MAX));
+#endif
+}
+//========================================================================
+// KLptStatsRow
+// Add a row to the histogram and extremes, returning its sum.  The row
+// was just digitized, so it is still in the cache.
+//========================================================================
+static u64 KLptStatsRow(struct sbig_area_stats *as, const u16 *p, int len,
+			u64 *sum2)
+{
+	u32 shift = as->hist_shift;
+	u64 sum = 0;
+	u16 u;
+	int j;
+
+	for (j = 0; j < len; j++) {
+		u = p[j];
+		sum += u;
+		*sum2 += (u32)u * u;
+		if (u < as->min)
+			as->min = u;
+		if (u > as->max)
+			as->max = u;
+		as->hist[min_t(u32, u >> shift, SBIG_STATS_BINS - 1)]++;
+	}
+	return sum;
+}
+//========================================================================
+// KLptStatsPercentile
+// Find the pixel value below which permille of the pixels fall, going
+// linearly through the bin it is in.
+//========================================================================
+static u16 KLptStatsPercentile(const struct sbig_area_stats *as,
+			       u32 permille)
+{
+	u64 rank = max_t(u64, DIV_ROUND_UP_ULL(as->pixels * permille, 1000),
+			 1);
+	u64 below = 0;
+	u32 v;
+	int b;
+
+	for (b = 0; b < SBIG_STATS_BINS - 1; b++) {
+		if (below + as->hist[b] >= rank)
+			break;
+		below += as->hist[b];
+	}
+	v = (b << as->hist_shift) +
+	    div_u64((rank - below - 1) << as->hist_shift, as->hist[b]);
+	return clamp_t(u32, v, as->min, as->max);
+}
+//========================================================================
+// KLptGetAreaStats
+// Get the statistics of an area, digitized a row at a time.
+//========================================================================
+int KLptGetAreaStats(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_area_stats *as;
+	enum camera_type cameraID;
+	int i, len, height;
+	u16 *kbuf = (u16 *)(pd->buffer);
+	u64 t0, port_ns = 0, predicted_ns;
+	u64 sum = 0, sum2 = 0, row_sum, q, r;
+	s64 var;
+	u32 mean;
+	int status;
+
+	as = kmalloc(sizeof(*as), GFP_KERNEL);
+	if (!as)
+		return -ENOMEM;
+	if (copy_from_user(as, (struct sbig_area_stats __user *)arg,
+			   sizeof(*as))) {
+		status = -EFAULT;
+		goto out_free;
+	}
+	cameraID = as->gap.cameraID;
+	len = as->gap.len;
+	height = as->gap.height;
+	status = CE_BAD_PARAMETER;
+	if (len <= 0 || height <= 0 || as->hist_shift > 16 ||
+	    pd->buffer_size < (unsigned long)len * 2)
+		goto out_free;
+	for (i = 0; i < SBIG_STATS_PERCENTILES; i++) {
+		if (as->permille[i] > 1000)
+			goto out_free;
+	}
+	as->min = U16_MAX;
+	as->max = 0;
+	memset(as->hist, 0, sizeof(as->hist));
+
+	KLptAdaptSettle(pd, true);
+	KLptProgress(pd, _IOC_NR(IOCTL_GET_AREA_STATS), 0, height);
+	sbig_jitter_begin(pd);
+	predicted_ns = KLptPredictArea(pd->sd, &as->gap);
+	for (i = 0; i < height; i++) {
+		t0 = ktime_get_ns();
+		status = KLptReadRow(pd, &as->gap, i, kbuf, i + 1 < height);
+		port_ns += ktime_get_ns() - t0;
+		if (status != CE_NO_ERROR)
+			goto out;
+		row_sum = KLptStatsRow(as, kbuf, len, &sum2);
+		sum += row_sum;
+		if (as->profile &&
+		    put_user((u32)div_u64(row_sum * 100, len),
+			     (u32 __user *)as->profile + i)) {
+			status = -EFAULT;
+			KLptFlushSerial(pd, cameraID, as->gap.ccd,
+					as->gap.clearWidth);
+			goto out;
+		}
+		status = KLptRowDone(pd, i + 1);
+		if (status < 0) {
+			KLptFlushSerial(pd, cameraID, as->gap.ccd,
+					as->gap.clearWidth);
+			goto out;
+		}
+
+		// yield between rows as in KLptGetArea
+		if (as->gap.ccd == CCD_IMAGING && cameraID != ST5C_CAMERA &&
+		    cameraID != ST237_CAMERA) {
+			status = sbig_sched_yield(pd, SBIG_CLASS_IMAGING);
+			if (status < 0)
+				goto out;
+		}
+		cond_resched();
+	}
+	sbig_jitter_end(pd, CE_NO_ERROR);
+	sbig_model_error(pd->sd, predicted_ns, port_ns);
+	KLptAdaptSettle(pd, false);
+
+	// E[x^2] - E[x]^2, divided first so nothing overflows
+	as->pixels = (u64)height * len;
+	mean = div64_u64(sum * 100, as->pixels);
+	q = div64_u64_rem(sum2, as->pixels, &r);
+	var = q * 10000 + div64_u64(r * 10000, as->pixels) -
+	      (u64)mean * mean;
+	as->mean = mean;
+	as->sd = KLptSqrt(max_t(s64, var, 0));
+	for (i = 0; i < SBIG_STATS_PERCENTILES; i++)
+		as->percentile[i] = KLptStatsPercentile(as, as->permille[i]);
+
+	if (copy_to_user((struct sbig_area_stats __user *)arg, as,
+			 sizeof(*as))) {
+		status = -EFAULT;
+		goto out_free;
+	}
+	sbig_stat_bytes(pd->sd, 0, sizeof(*as));
+	sbig_status_add(pd->sd, 1, 0, 0, 0);
+	status = CE_NO_ERROR;
+	goto out_free;
+out:
+	sbig_jitter_end(pd, status);
+out_free:
+	kfree(as);
+	return status;
+}
+//========================================================================
+// KLptDumpImaging
 // Dump lines of pixels at the Imaging CCD.
 //
 // Since the Imaging CCD is a kodak part without parallel register clear
 // the entire readout	register must be cleared by clocking it.
 //
 // The width is the width of the CCD unbinned and the	len is the number
-// of bined rows to dump.
+// of bined rows to dump.  Progress is reported from row on.
 //========================================================================
-int KLptDumpImagingLines(struct sbig_client *pd, unsigned long arg)
+static int KLptDumpImaging(struct sbig_client *pd,
+			   const struct ioc_dump_lines_params *dlp, u32 row)
 {
 	int status;
-	struct ioc_dump_lines_params dlp;
 	enum camera_type cameraID;
 	int width;
 	int len;
@@ -992,31 +1479,23 @@ int KLptDumpImagingLines(struct sbig_client *pd, unsigned long arg)
 	int dumpRatio;
 	u8 ic;
 
-	status = copy_from_user(&dlp,
-				(struct ioc_dump_lines_params __user *)arg,
-				sizeof(struct ioc_dump_lines_params));
-	if (status != 0) {
-		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
-		return -EFAULT;
-	}
-
-	cameraID = dlp.cameraID;
-	width = dlp.width;
-	len = dlp.len;
-	vertBin = dlp.vertBin;
+	cameraID = dlp->cameraID;
+	width = dlp->width;
+	len = dlp->len;
+	vertBin = dlp->vertBin;
 
 	// 5/14/99 - don't turn up Vdd yet
 	// ic = TRG_H;
 
 	// 2/21/02 - don't change Vdd, set outside of here
-	ic = (pd->imaging_clocks_out & TRG_H);
+	ic = (pd->sd->imaging_clocks_out & TRG_H);
 
 	KLptCameraOut(pd, CONTROL_OUT, IMAGING_SELECT);
 
-	if (dlp.vToHRatio == 0)
-		dumpRatio = DUMP_RATIO;
+	if (dlp->vToHRatio == 0)
+		dumpRatio = max(READ_ONCE(pd->sd->timing.dump_ratio), 1U);
 	else
-		dumpRatio = dlp.vToHRatio;
+		dumpRatio = dlp->vToHRatio;
 
 	for (i = 0; i < len; i++) {
 		// do vertical shift of lines
@@ -1029,11 +1508,16 @@ int KLptDumpImagingLines(struct sbig_client *pd, unsigned long arg)
 			if (status != CE_NO_ERROR)
 				return status;
 		}
+		status = KLptRowDone(pd, row + i + 1);
+		if (status < 0) {
+			KLptFlushSerial(pd, cameraID, CCD_IMAGING, width);
+			return status;
+		}
 	}
 	return CE_NO_ERROR;
 }
 //========================================================================
-// KLptDumpTrackingLines
+// KLptDumpTracking
 // Discard a line of pixels in the tracking CCD.
 //
 // Since the tracking CCD is a TC211 with full drain clear we only need
@@ -1042,29 +1526,23 @@ int KLptDumpImagingLines(struct sbig_client *pd, unsigned long arg)
 // The width is the width of the CCD unbinned and the	len is the number
 // of bined rows to dump.
 //========================================================================
-int KLptDumpTrackingLines(struct sbig_client *pd, unsigned long arg)
+static int KLptDumpTracking(struct sbig_client *pd,
+			    const struct ioc_dump_lines_params *dlp)
 {
 	int status;
-	struct ioc_dump_lines_params dlp;
 	enum camera_type cameraID;
 	int width;
 	int len;
 	int vertBin;
 	int i;
+	enum sbig_op op;
 
-	status = copy_from_user(&dlp,
-				(struct ioc_dump_lines_params __user *)arg,
-				sizeof(struct ioc_dump_lines_params));
-	if (status != 0) {
-		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
-		return -EFAULT;
-	}
-
-	cameraID = dlp.cameraID;
-	width = dlp.width;
-	len = dlp.len;
-	vertBin = dlp.vertBin;
+	cameraID = dlp->cameraID;
+	width = dlp->width;
+	len = dlp->len;
+	vertBin = dlp->vertBin;
 
+	op = KLptOpBegin(pd, SBIG_OP_VCLOCK);
 	KDisable(pd); // shorts off for vert shift
 	KLptCameraOut(pd, CONTROL_OUT, TRACKING_SELECT); // select tracking CCD
 	KLptCameraOut(pd, TRACKING_CLOCKS,
@@ -1080,12 +1558,13 @@ int KLptDumpTrackingLines(struct sbig_client *pd, unsigned long arg)
 	}
 	KLptCameraOut(pd, TRACKING_CLOCKS, 0); // all clocks low
 	KEnable(pd);
+	KLptOpEnd(pd, op, vertBin * len);
 	// dump the serial register too
 	status = KLptBlockClearPixels(pd, cameraID, CCD_TRACKING, width, 0);
 	return status;
 }
 //========================================================================
-// KLptDumpST5CLines:
+// KLptDumpST5C
 // Discard a line of pixels in the TC255 CCD.
 //
 // Since the CCD is a TC255 with full	drain clear we only need to do the
@@ -1094,29 +1573,23 @@ int KLptDumpTrackingLines(struct sbig_client *pd, unsigned long arg)
 // The width is the width of the CCD unbinned and the	len is the number
 // of bined rows to dump.
 //========================================================================
-int KLptDumpST5CLines(struct sbig_client *pd, unsigned long arg)
+static int KLptDumpST5C(struct sbig_client *pd,
+			const struct ioc_dump_lines_params *dlp)
 {
 	int status;
-	struct ioc_dump_lines_params dlp;
 	enum camera_type cameraID;
 	int width;
 	int len;
 	int vertBin;
 	int i;
+	enum sbig_op op;
 
-	status = copy_from_user(&dlp,
-				(struct ioc_dump_lines_params __user *)arg,
-				sizeof(struct ioc_dump_lines_params));
-	if (status != 0) {
-		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
-		return -EFAULT;
-	}
-
-	cameraID = dlp.cameraID;
-	width = dlp.width;
-	len = dlp.len;
-	vertBin = dlp.vertBin;
+	cameraID = dlp->cameraID;
+	width = dlp->width;
+	len = dlp->len;
+	vertBin = dlp->vertBin;
 
+	op = KLptOpBegin(pd, SBIG_OP_VCLOCK);
 	KDisable(pd); // interrupts off for vert shift
 	KLptCameraOut(pd, READOUT_CONTROL, 0); // select PC control of CCD
 	// do vertical shift
@@ -1128,11 +1601,352 @@ int KLptDumpST5CLines(struct sbig_client *pd, unsigned long arg)
 		KLptCameraOut(pd, IMAGING_CLOCKS, 0); // all low
 	}
 	KEnable(pd);
+	KLptOpEnd(pd, op, vertBin * len);
 	// Dump the serial register too
 	status = KLptBlockClearPixels(pd, cameraID, CCD_IMAGING, width, 0);
 	return status;
 }
 //========================================================================
+// KLptDumpLines
+// Dump lines with the fast path of the CCD they are on.
+//========================================================================
+static int KLptDumpLines(struct sbig_client *pd, enum ccd_request ccd,
+			 const struct ioc_dump_lines_params *dlp, u32 row)
+{
+	sbig_idle_touch(pd->sd, ccd);
+	if (dlp->cameraID == ST5C_CAMERA || dlp->cameraID == ST237_CAMERA)
+		return KLptDumpST5C(pd, dlp);
+	if (ccd == CCD_IMAGING)
+		return KLptDumpImaging(pd, dlp, row);
+	return KLptDumpTracking(pd, dlp);
+}
+//========================================================================
+// KLptDumpImagingLines
+//========================================================================
+int KLptDumpImagingLines(struct sbig_client *pd, unsigned long arg)
+{
+	struct ioc_dump_lines_params dlp;
+
+	if (copy_from_user(&dlp, (struct ioc_dump_lines_params __user *)arg,
+			   sizeof(dlp))) {
+		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
+		return -EFAULT;
+	}
+	sbig_idle_touch(pd->sd, CCD_IMAGING);
+	KLptProgress(pd, _IOC_NR(IOCTL_DUMP_ILINES), 0, dlp.len);
+	return KLptDumpImaging(pd, &dlp, 0);
+}
+//========================================================================
+// KLptDumpTrackingLines
+//========================================================================
+int KLptDumpTrackingLines(struct sbig_client *pd, unsigned long arg)
+{
+	struct ioc_dump_lines_params dlp;
+
+	if (copy_from_user(&dlp, (struct ioc_dump_lines_params __user *)arg,
+			   sizeof(dlp))) {
+		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
+		return -EFAULT;
+	}
+	sbig_idle_touch(pd->sd, CCD_TRACKING);
+	return KLptDumpTracking(pd, &dlp);
+}
+//========================================================================
+// KLptDumpST5CLines
+//========================================================================
+int KLptDumpST5CLines(struct sbig_client *pd, unsigned long arg)
+{
+	struct ioc_dump_lines_params dlp;
+
+	if (copy_from_user(&dlp, (struct ioc_dump_lines_params __user *)arg,
+			   sizeof(dlp))) {
+		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
+		return -EFAULT;
+	}
+	sbig_idle_touch(pd->sd, CCD_IMAGING);
+	return KLptDumpST5C(pd, &dlp);
+}
+//========================================================================
+// KLptGetPreview
+// Digitize every row_step-th row of an area, dumping the rows between
+// with the fast line dump of the CCD, and keep every col_step-th pixel.
+//========================================================================
+int KLptGetPreview(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_preview pv;
+	struct ioc_dump_lines_params dlp = { 0 };
+	enum camera_type cameraID;
+	u16 *kbuf = (u16 *)(pd->buffer);
+	u16 *row;
+	u32 rows, cols, bytes;
+	int i, k, status;
+
+	if (copy_from_user(&pv, (struct sbig_preview __user *)arg,
+			   sizeof(pv)))
+		return -EFAULT;
+	if (pv.gap.len <= 0 || pv.gap.height <= 0 || pv.row_step == 0 ||
+	    pv.col_step == 0)
+		return CE_BAD_PARAMETER;
+	cameraID = pv.gap.cameraID;
+	rows = DIV_ROUND_UP(pv.gap.height, pv.row_step);
+	cols = DIV_ROUND_UP(pv.gap.len, pv.col_step);
+	bytes = rows * cols * 2;
+
+	// rows are digitized in place and squeezed towards the start
+	if (pv.length != bytes ||
+	    pd->buffer_size < ((rows - 1) * cols + pv.gap.len) * 2)
+		return CE_BAD_PARAMETER;
+
+	dlp.cameraID = cameraID;
+	dlp.width = pv.gap.clearWidth;
+	dlp.len = pv.row_step - 1;
+	dlp.vertBin = pv.gap.vertBin;
+
+	KLptAdaptSettle(pd, true);
+	KLptProgress(pd, _IOC_NR(IOCTL_GET_PREVIEW), 0, pv.gap.height);
+	for (i = 0; i < rows; i++) {
+		if (i > 0 && dlp.len > 0) {
+			status = KLptDumpLines(pd, pv.gap.ccd, &dlp,
+					       (i - 1) * pv.row_step + 1);
+			if (status != CE_NO_ERROR)
+				goto out;
+		}
+		row = kbuf + i * cols;
+		status = KLptReadRow(pd, &pv.gap, i * pv.row_step, row,
+				     pv.row_step == 1 && i + 1 < rows);
+		if (status != CE_NO_ERROR)
+			goto out;
+		for (k = 1; k < cols; k++)
+			row[k] = row[k * pv.col_step];
+		status = KLptRowDone(pd, i * pv.row_step + 1);
+		if (status < 0)
+			goto out;
+
+		// yield between rows as in KLptGetArea
+		if (pv.gap.ccd == CCD_IMAGING && cameraID != ST5C_CAMERA &&
+		    cameraID != ST237_CAMERA) {
+			status = sbig_sched_yield(pd, SBIG_CLASS_IMAGING);
+			if (status < 0)
+				goto out;
+		}
+		cond_resched();
+	}
+	status = CE_NO_ERROR;
+out:
+	// a failed yield leaves the port to others, the device is gone
+	if (status != CE_NO_ERROR && status != -ENODEV)
+		KLptFlushSerial(pd, cameraID, pv.gap.ccd, pv.gap.clearWidth);
+	KLptAdaptSettle(pd, false);
+	if (status != CE_NO_ERROR)
+		return status;
+
+	if (copy_to_user((u16 __user *)pv.dest, kbuf, bytes))
+		return -EFAULT;
+	sbig_stat_bytes(pd->sd, 0, bytes);
+	sbig_status_add(pd->sd, 1, 0, 0, bytes);
+	return CE_NO_ERROR;
+}
+//========================================================================
+// KLptRoisSpan
+// Find the pixels of row y that regions are on.  Returns FALSE if none.
+//========================================================================
+static bool KLptRoisSpan(const struct sbig_rois *rs, u32 y, u32 *lo,
+			 u32 *hi)
+{
+	const struct sbig_roi *r;
+	u32 n, l = U32_MAX, h = 0;
+
+	for (n = 0; n < rs->count; n++) {
+		r = &rs->roi[n];
+		if (y < r->top || y >= r->top + r->height)
+			continue;
+		l = min_t(u32, l, r->left);
+		h = max_t(u32, h, r->left + r->len);
+	}
+	*lo = l;
+	*hi = h;
+	return h > 0;
+}
+//========================================================================
+// KLptGetRois
+// Read several regions of an exposure in one pass from the top.  Rows
+// no region is on are dumped, and each row read is digitized from the
+// leftmost to the rightmost region on it.
+//========================================================================
+int KLptGetRois(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_rois *rs;
+	struct ioc_get_area_params gap;
+	struct ioc_dump_lines_params dlp = { 0 };
+	const struct sbig_roi *r;
+	u16 *kbuf = (u16 *)(pd->buffer);
+	u16 *row;
+	u32 off[SBIG_ROIS_MAX];
+	u32 bytes = 0, bottom = 0, lo, hi, y, skip = 0, n;
+	u32 next_lo, next_hi;
+	bool more;
+	int width, status;
+
+	rs = kmalloc(sizeof(*rs), GFP_KERNEL);
+	if (!rs)
+		return -ENOMEM;
+	status = -EFAULT;
+	if (copy_from_user(rs, (struct sbig_rois __user *)arg, sizeof(*rs)))
+		goto out;
+	status = CE_BAD_PARAMETER;
+	width = rs->gap.len;
+	if (rs->count == 0 || rs->count > SBIG_ROIS_MAX || width <= 0)
+		goto out;
+	for (n = 0; n < rs->count; n++) {
+		r = &rs->roi[n];
+		if (r->height == 0 || r->len == 0 ||
+		    r->left + r->len > width ||
+		    r->top + r->height > max_t(int, rs->gap.height, 0))
+			goto out;
+		off[n] = bytes / 2;
+		bytes += r->height * r->len * 2;
+		if (bytes > pd->buffer_size)
+			goto out;
+		bottom = max_t(u32, bottom, r->top + r->height);
+	}
+	if (rs->length != bytes || pd->buffer_size < bytes + width * 2)
+		goto out;
+	row = kbuf + bytes / 2;
+
+	gap = rs->gap;
+	dlp.cameraID = gap.cameraID;
+	dlp.width = gap.clearWidth;
+	dlp.vertBin = gap.vertBin;
+
+	KLptAdaptSettle(pd, true);
+	KLptProgress(pd, _IOC_NR(IOCTL_GET_ROIS), 0, bottom);
+	for (y = 0; y < bottom; y++) {
+		if (!KLptRoisSpan(rs, y, &lo, &hi)) {
+			skip++;
+			continue;
+		}
+		if (skip > 0) {
+			dlp.len = skip;
+			status = KLptDumpLines(pd, gap.ccd, &dlp, y - skip);
+			if (status != CE_NO_ERROR)
+				goto out;
+			skip = 0;
+		}
+		gap.left = lo;
+		gap.len = hi - lo;
+		gap.right = width - hi;
+		more = KLptRoisSpan(rs, y + 1, &next_lo, &next_hi);
+		status = KLptReadRow(pd, &gap, y, row, more);
+		if (status != CE_NO_ERROR)
+			goto out;
+		for (n = 0; n < rs->count; n++) {
+			r = &rs->roi[n];
+			if (y < r->top || y >= r->top + r->height)
+				continue;
+			memcpy(kbuf + off[n] + (y - r->top) * r->len,
+			       row + r->left - lo, r->len * 2);
+		}
+		status = KLptRowDone(pd, y + 1);
+		if (status < 0) {
+			KLptFlushSerial(pd, gap.cameraID, gap.ccd,
+					gap.clearWidth);
+			goto out;
+		}
+
+		// yield between rows as in KLptGetArea
+		if (gap.ccd == CCD_IMAGING && gap.cameraID != ST5C_CAMERA &&
+		    gap.cameraID != ST237_CAMERA) {
+			status = sbig_sched_yield(pd, SBIG_CLASS_IMAGING);
+			if (status < 0)
+				goto out;
+		}
+		cond_resched();
+	}
+	KLptAdaptSettle(pd, false);
+
+	status = -EFAULT;
+	if (copy_to_user((u16 __user *)rs->dest, kbuf, bytes))
+		goto out;
+	sbig_stat_bytes(pd->sd, 0, bytes);
+	sbig_status_add(pd->sd, 1, 0, 0, bytes);
+	status = CE_NO_ERROR;
+out:
+	kfree(rs);
+	return status;
+}
+//========================================================================
+// KLptTdiScan
+// Drift scan the imaging CCD a row every period_ns, see tdi.c.  Each
+// row waits for its deadline on an hrtimer, then is clocked down and
+// digitized into the client's ring.  IOCTL_CANCEL ends an endless scan.
+//========================================================================
+int KLptTdiScan(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_tdi_scan ts;
+	struct ioc_get_area_params *gap = &ts.gap;
+	u16 *kbuf = (u16 *)(pd->buffer);
+	u16 *row;
+	u64 t0, deadline, late_ns;
+	u32 i;
+	int status;
+
+	if (copy_from_user(&ts, (struct sbig_tdi_scan __user *)arg,
+			   sizeof(ts))) {
+		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
+		return -EFAULT;
+	}
+	if (gap->ccd != CCD_IMAGING || gap->cameraID == ST5C_CAMERA ||
+	    gap->cameraID == ST237_CAMERA || gap->len <= 0 ||
+	    gap->height < 0 || ts.ring_rows == 0 || ts.period_ns == 0 ||
+	    pd->buffer_size < gap->len * 2)
+		return CE_BAD_PARAMETER;
+	status = sbig_tdi_begin(pd, gap->len, ts.ring_rows, ts.period_ns);
+	if (status != CE_NO_ERROR)
+		return status;
+
+	KLptAdaptSettle(pd, true);
+	KLptProgress(pd, _IOC_NR(IOCTL_TDI_SCAN), 0, gap->height);
+	t0 = ktime_get_ns();
+	for (i = 0; gap->height == 0 || i < gap->height; i++) {
+		deadline = t0 + i * ts.period_ns;
+		while (sbig_wait_until(deadline)) {
+			status = KLptRowDone(pd, i);
+			if (status < 0)
+				goto out;
+		}
+		late_ns = ktime_get_ns() - deadline;
+
+		// a full ring drops the row, it must be clocked out anyway
+		row = sbig_tdi_slot(pd);
+		status = KLptReadRow(pd, gap, i, row ? row : kbuf, true);
+		if (status != CE_NO_ERROR)
+			goto out;
+		sbig_tdi_push(pd, row != NULL, late_ns);
+		status = KLptRowDone(pd, i + 1);
+		if (status < 0)
+			goto out;
+
+		// yield between rows as in KLptGetArea
+		status = sbig_sched_yield(pd, SBIG_CLASS_IMAGING);
+		if (status < 0)
+			goto out;
+		cond_resched();
+	}
+	status = CE_NO_ERROR;
+out:
+	// rows are left in the serial register by merged clears, unless
+	// the device is gone and a failed yield gave the port away
+	if (status != -ENODEV)
+		KLptFlushSerial(pd, gap->cameraID, gap->ccd,
+				gap->clearWidth);
+	if (status == -ECANCELED && gap->height == 0)
+		status = CE_NO_ERROR;
+	if (status == CE_NO_ERROR)
+		KLptAdaptSettle(pd, false);
+	sbig_tdi_end(pd);
+	return status;
+}
+//========================================================================
 // KLptClockAD
 // Clock the AD the number of times passed.
 //========================================================================
@@ -1166,6 +1980,144 @@ int KLptClockAD(struct sbig_client *pd, unsigned long arg)
 	return status;
 }
 //========================================================================
+// KLptClearImagingRow
+// Shift a row of the Imaging CCD out and clear it from the serial
+// register.  CONTROL_OUT and TRACKING_CLOCKS must be set up for it.
+//========================================================================
+static int KLptClearImagingRow(struct sbig_client *pd,
+			       enum camera_type cameraID)
+{
+	int status;
+
+	status = KLptVClockImagingCCD(pd, cameraID, IABG_M, 2);
+	if (status != CE_NO_ERROR)
+		return status;
+
+	// do Horizontal Clear of Blocks of 10 Pixels
+	return KLptHClear(pd, cameraID == ST1K_CAMERA ? 6 : 1);
+}
+//========================================================================
+// KLptClearTrackingRow
+// Shift a row of the Tracking CCD out and clear it from the serial
+// register.  CONTROL_OUT must select the tracking CCD.
+//========================================================================
+static int KLptClearTrackingRow(struct sbig_client *pd)
+{
+	KDisable(pd);
+
+	KLptCameraOut(pd, TRACKING_CLOCKS,
+		      TABG_M + CLR + IAG_H); // IAG high
+	KLptCameraOut(pd, TRACKING_CLOCKS,
+		      TABG_M + CLR + BIN + IAG_H); // IAG+SRG high
+	KLptCameraOut(pd, TRACKING_CLOCKS,
+		      TABG_M + CLR + BIN); // SRG high
+
+	// then shift CLEAR_BLOCK horizontally
+	KLptCameraOut(pd, TRACKING_CLOCKS, CLR); // set PAL for clear
+		// all clocks low
+	KLptCameraOut(pd, CONTROL_OUT, TRACKING_SELECT + AD_TRIGGER);
+	KLptCameraOut(pd, CONTROL_OUT, TRACKING_SELECT);
+
+	KEnable(pd);
+
+	return KLptWaitForPLD(pd);
+}
+//========================================================================
+// KLptIdleClearRow
+// Clear a row of a CCD while the port is idle, see idle.c.
+//========================================================================
+int KLptIdleClearRow(struct sbig_client *pd, enum ccd_request ccd,
+		     enum camera_type cameraID)
+{
+	enum sbig_op op = KLptOpBegin(pd, SBIG_OP_CLEAR);
+	int status;
+
+	if (ccd == CCD_IMAGING) {
+		KLptCameraOut(pd, CONTROL_OUT, IMAGING_SELECT);
+		KLptCameraOut(pd, TRACKING_CLOCKS, CLR);
+		status = KLptClearImagingRow(pd, cameraID);
+	} else {
+		KLptCameraOut(pd, CONTROL_OUT, TRACKING_SELECT);
+		status = KLptClearTrackingRow(pd);
+	}
+	KLptOpEnd(pd, op, 1);
+	return status;
+}
+//========================================================================
+// KLptGuideFrame
+// A step of IOCTL_GUIDE_STREAM on the port: clear the tracking CCD to
+// start integrating, or if f->pixels is set read the region into it.
+//========================================================================
+static int KLptGuideFrame(struct sbig_client *pd, struct sbig_guide_frame *f)
+{
+	const struct sbig_guide_stream *gs = f->gs;
+	const struct ioc_get_area_params *gap = &gs->gap;
+	struct ioc_dump_lines_params dlp = { 0 };
+	enum sbig_op op;
+	int i, status = CE_NO_ERROR;
+
+	if (!f->pixels) {
+		op = KLptOpBegin(pd, SBIG_OP_CLEAR);
+		KLptCameraOut(pd, CONTROL_OUT, TRACKING_SELECT);
+		for (i = 0; i < gs->ccd_height; i++) {
+			status = KLptClearTrackingRow(pd);
+			if (status != CE_NO_ERROR)
+				break;
+		}
+		KLptOpEnd(pd, op, i);
+		f->t_ns = ktime_get_ns();
+		return status;
+	}
+
+	f->t_ns = ktime_get_ns();
+	if (gs->top > 0) {
+		dlp.cameraID = gap->cameraID;
+		dlp.width = gap->clearWidth;
+		dlp.len = gs->top;
+		dlp.vertBin = gap->vertBin;
+		status = KLptDumpLines(pd, CCD_TRACKING, &dlp, 0);
+		if (status != CE_NO_ERROR)
+			return status;
+	}
+	for (i = 0; i < gap->height; i++) {
+		status = KLptReadRow(pd, gap, gs->top + i,
+				     f->pixels + i * gap->len,
+				     i + 1 < gap->height);
+		if (status != CE_NO_ERROR)
+			return status;
+		status = KLptRowDone(pd, i + 1);
+		if (status < 0) {
+			KLptFlushSerial(pd, gap->cameraID, gap->ccd,
+					gap->clearWidth);
+			return status;
+		}
+	}
+	return CE_NO_ERROR;
+}
+//========================================================================
+// KLptTimedMicroSend
+// Send the block of IOCTL_TIMED_MICRO_BLOCK at its deadline: sleep on an
+// hrtimer, then spin the last micro_spin_us, see micro.c.
+//========================================================================
+static int KLptTimedMicroSend(struct sbig_client *pd,
+			      struct sbig_micro_frame *f)
+{
+	u64 spin_ns = (u64)READ_ONCE(pd->sd->micro.spin_us) * NSEC_PER_USEC;
+	int status;
+
+	spin_ns = min(spin_ns, f->deadline_ns);
+	while (sbig_micro_wait(f->clock, f->deadline_ns - spin_ns)) {
+		status = KLptRowDone(pd, 0);
+		if (status < 0)
+			return status;
+	}
+	sbig_micro_spin(f->clock, f->deadline_ns, spin_ns);
+	f->start_ns = sbig_micro_now(f->clock);
+	status = KLptMicroSend(pd, f->data, f->length);
+	f->end_ns = sbig_micro_now(f->clock);
+	return status;
+}
+//========================================================================
 // KLptClearImagingArray
 // Do a fast clear of the imaging array by doing vertical shifts and
 // only clearing CLEAR_BLOCK pixels per line.
@@ -1195,15 +2147,18 @@ int KLptClearImagingArray(struct sbig_client *pd, unsigned long arg)
 	KLptCameraOut(pd, TRACKING_CLOCKS, CLR);
 	times *= height;
 
+	// idle clearing swept the array already, see idle.c
+	if (sbig_idle_take(pd->sd, CCD_IMAGING, cameraID, max(times, 0)))
+		times = 1;
+
 	// clear the array the required number of times
+	KLptProgress(pd, _IOC_NR(IOCTL_CLEAR_IMAG_CCD), 0, times);
 	for (i = 0; i < times; i++) {
-		status = KLptVClockImagingCCD(pd, cameraID, IABG_M, 2);
+		status = KLptClearImagingRow(pd, cameraID);
 		if (status != CE_NO_ERROR)
 			return status;
-
-		// do Horizontal Clear of Blocks of 10 Pixels
-		status = KLptHClear(pd, cameraID == ST1K_CAMERA ? 6 : 1);
-		if (status != CE_NO_ERROR)
+		status = KLptRowDone(pd, i + 1);
+		if (status < 0)
 			return status;
 	}
 	return CE_NO_ERROR;
@@ -1221,6 +2176,7 @@ int KLptClearTrackingArray(struct sbig_client *pd, unsigned long arg)
 	int times;
 	int i;
 	struct ioc_clear_ccd_params cccdp;
+	enum sbig_op op;
 
 	status = copy_from_user(&cccdp,
 				(struct ioc_clear_ccd_params __user *)arg,
@@ -1234,33 +2190,149 @@ int KLptClearTrackingArray(struct sbig_client *pd, unsigned long arg)
 	height = cccdp.height;
 	times = cccdp.times;
 
+	op = KLptOpBegin(pd, SBIG_OP_CLEAR);
 	KLptCameraOut(pd, CONTROL_OUT, TRACKING_SELECT);
 	times *= height;
 
+	// idle clearing swept the array already, see idle.c
+	if (sbig_idle_take(pd->sd, CCD_TRACKING, cameraID, max(times, 0)))
+		times = 1;
+
 	// clear the array the required number of times
+	KLptProgress(pd, _IOC_NR(IOCTL_CLEAR_TRAC_CCD), 0, times);
 	for (i = 0; i < times; i++) {
-		KDisable(pd);
-
-		KLptCameraOut(pd, TRACKING_CLOCKS,
-			      TABG_M + CLR + IAG_H); // IAG high
-		KLptCameraOut(pd, TRACKING_CLOCKS,
-			      TABG_M + CLR + BIN + IAG_H); // IAG+SRG high
-		KLptCameraOut(pd, TRACKING_CLOCKS,
-			      TABG_M + CLR + BIN); // SRG high
-
-		// then shift CLEAR_BLOCK horizontally
-		KLptCameraOut(pd, TRACKING_CLOCKS, CLR); // set PAL for clear
-			// all clocks low
-		KLptCameraOut(pd, CONTROL_OUT, TRACKING_SELECT + AD_TRIGGER);
-		KLptCameraOut(pd, CONTROL_OUT, TRACKING_SELECT);
-
-		KEnable(pd);
+		status = KLptClearTrackingRow(pd);
+		if (status == CE_NO_ERROR)
+			status = KLptRowDone(pd, i + 1);
+		if (status != CE_NO_ERROR)
+			break;
+	}
+	KLptOpEnd(pd, op, i);
+	return status;
+}
+//========================================================================
+// KLptBiasFrame
+// Clear the imaging array and read a frame from it, returning the mean
+// and standard deviation of its pixels in 1/100 ADU.
+//========================================================================
+static int KLptBiasFrame(struct sbig_client *pd,
+			 const struct sbig_autotune *at, u32 *mean, u32 *sd)
+{
+	const struct ioc_get_area_params *gap = &at->gap;
+	enum camera_type cameraID = gap->cameraID;
+	u16 *kbuf = (u16 *)pd->buffer;
+	u32 n = gap->height * gap->len;
+	u64 sum = 0, var = 0;
+	s64 d;
+	int status;
+	u32 i;
 
-		status = KLptWaitForPLD(pd);
+	KLptCameraOut(pd, CONTROL_OUT, IMAGING_SELECT);
+	KLptCameraOut(pd, TRACKING_CLOCKS, CLR);
+	for (i = 0; i < at->clear_height; i++) {
+		status = KLptClearImagingRow(pd, cameraID);
+		if (status != CE_NO_ERROR)
+			return status;
+	}
+	for (i = 0; i < gap->height; i++) {
+		status = KLptReadRow(pd, gap, i, kbuf + i * gap->len,
+				     i + 1 < gap->height);
 		if (status != CE_NO_ERROR)
 			return status;
 	}
+	for (i = 0; i < n; i++)
+		sum += kbuf[i];
+	*mean = div_u64(sum * 100, n);
+	for (i = 0; i < n; i++) {
+		d = (s64)kbuf[i] * 100 - *mean;
+		var += d * d;
+	}
+	var = div_u64(var, n);
+	*sd = KLptSqrt(var);
+	return CE_NO_ERROR;
+}
+//========================================================================
+// KLptAutoTune
+// Step the vertical clock delay down by a quarter at a time while bias
+// frames read the same as at the default delay: the mean within half a
+// standard deviation, and the noise no more than 10% higher.  Settle
+// one step above the shortest delay that passed, unless none failed.
+//
+// Bias frames hold no charge, so this can't find a serial register
+// overflowing for too high a dump ratio, nor does it time the micro.
+// Those are left as they are.
+//========================================================================
+int KLptAutoTune(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_device *sd = pd->sd;
+	struct sbig_autotune at;
+	struct sbig_timing t;
+	unsigned int delay, next;
+	u32 mean, sdev, delay_mean, delay_sd;
+	bool failed = false;
+	int status, bias;
+
+	if (copy_from_user(&at, (struct sbig_autotune __user *)arg,
+			   sizeof(at)))
+		return -EFAULT;
+	if (at.gap.ccd != CCD_IMAGING || at.gap.height <= 0 ||
+	    at.gap.len <= 0 || at.gap.left < 0 || at.gap.right < 0 ||
+	    pd->buffer_size < (unsigned long)at.gap.height * at.gap.len * 2)
+		return CE_BAD_PARAMETER;
+
+	sbig_timing_get(sd, &t);
+	KLptAdaptSettle(pd, true);
+	KLptProgress(pd, _IOC_NR(IOCTL_AUTOTUNE), 0, 0);
+	delay = sbig_timing_default.vclock_delay_ns;
+	sbig_timing_set_vclock(sd, delay);
+	status = KLptBiasFrame(pd, &at, &at.ref_mean, &at.ref_sd);
+	if (status != CE_NO_ERROR)
+		goto out;
+	at.vclock_delay_ns = delay;
+	at.mean = delay_mean = at.ref_mean;
+	at.sd = delay_sd = at.ref_sd;
+	at.steps = 1;
+
+	for (next = delay * 3 / 4; next >= sd->io_read_ns;
+	     next = delay * 3 / 4) {
+		sbig_timing_set_vclock(sd, next);
+		bias = KLptBiasFrame(pd, &at, &mean, &sdev);
+		if (bias != CE_NO_ERROR && bias != CE_AD_TIMEOUT) {
+			status = bias;
+			goto out;
+		}
+		status = KLptRowDone(pd, ++at.steps);
+		if (status < 0)
+			goto out;
+		// too short for the A/D fails the step, mean and sdev unset
+		if (bias == CE_AD_TIMEOUT ||
+		    abs((s64)mean - at.ref_mean) > at.ref_sd / 2 ||
+		    sdev > at.ref_sd + at.ref_sd / 10) {
+			failed = true;
+			break;
+		}
+		at.vclock_delay_ns = delay;
+		at.mean = delay_mean;
+		at.sd = delay_sd;
+		delay = next;
+		delay_mean = mean;
+		delay_sd = sdev;
+	}
+	if (!failed) {
+		at.vclock_delay_ns = delay;
+		at.mean = delay_mean;
+		at.sd = delay_sd;
+	}
+	KLptAdaptSettle(pd, false);
+	t.vclock_delay_ns = at.vclock_delay_ns;
+	sbig_timing_tuned(sd, &t);
+	if (copy_to_user((struct sbig_autotune __user *)arg, &at, sizeof(at)))
+		return -EFAULT;
 	return CE_NO_ERROR;
+out:
+	KLptAdaptSettle(pd, false);
+	sbig_timing_set_vclock(sd, t.vclock_delay_ns);
+	return status;
 }
 //========================================================================
 // KLptGetDriverInfo
@@ -1284,8 +2356,7 @@ int KLptGetDriverInfo(struct sbig_client *pd, unsigned long arg)
 	return CE_NO_ERROR;
 }
 //========================================================================
-int KLptSetBufferSize(struct sbig_client *pd, spinlock_t *lock,
-		      unsigned long arg)
+int KLptSetBufferSize(struct sbig_client *pd, unsigned long arg)
 {
 	int status;
 	u16 buffer_size;
@@ -1307,10 +2378,10 @@ int KLptSetBufferSize(struct sbig_client *pd, spinlock_t *lock,
 	pd->buffer_size = buffer_size;
 
 	// kfree old kernel-space I/O buffer and asign new one
-	spin_lock(lock);
+	spin_lock(&pd->sd->spinlock);
 	kfree(pd->buffer);
 	pd->buffer = kbuff;
-	spin_unlock(lock);
+	spin_unlock(&pd->sd->spinlock);
 out:
 	sbig_dbg(pd, "%s: %d\n", __func__, pd->buffer_size);
 	return pd->buffer_size;
@@ -1328,6 +2399,283 @@ int KLptTestCommand(struct sbig_client *pd)
 	return CE_NO_ERROR;
 }
 //========================================================================
+// KLptGetProgress
+// Return the progress of the port command in progress, if any.
+//========================================================================
+int KLptGetProgress(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_device *sd = pd->sd;
+	struct sbig_progress pr;
+
+	pr.cmd = READ_ONCE(sd->progress_cmd);
+	pr.row = READ_ONCE(sd->progress_row);
+	pr.total = READ_ONCE(sd->progress_total);
+	if (copy_to_user((struct sbig_progress __user *)arg, &pr, sizeof(pr)))
+		return -EFAULT;
+	return CE_NO_ERROR;
+}
+//========================================================================
+// KLptPredict
+// Return how long IOCTL_GET_AREA would take on the port.
+//========================================================================
+int KLptPredict(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_predict pr;
+
+	if (copy_from_user(&pr, (struct sbig_predict __user *)arg, sizeof(pr)))
+		return -EFAULT;
+	pr.ns = KLptPredictArea(pd->sd, &pr.gap);
+	if (copy_to_user((struct sbig_predict __user *)arg, &pr, sizeof(pr)))
+		return -EFAULT;
+	return CE_NO_ERROR;
+}
+//========================================================================
+// KLptAccumulate
+// Start summing the frames IOCTL_GET_AREA reads with a geometry, fetch
+// the sums or stop.
+//========================================================================
+int KLptAccumulate(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_accumulate ac;
+	size_t size;
+
+	if (copy_from_user(&ac, (struct sbig_accumulate __user *)arg,
+			   sizeof(ac)))
+		return -EFAULT;
+	switch (ac.op) {
+	case SBIG_ACCUM_START:
+		if (ac.gap.height <= 0 || ac.gap.len <= 0)
+			return CE_BAD_PARAMETER;
+		vfree(pd->accum);
+		pd->accum_gap = ac.gap;
+		pd->accum_frames = 0;
+		pd->accum = vzalloc((size_t)ac.gap.height * ac.gap.len *
+				    sizeof(u32));
+		if (!pd->accum)
+			return -ENOMEM;
+		break;
+	case SBIG_ACCUM_FETCH:
+		if (!pd->accum)
+			return CE_BAD_PARAMETER;
+		size = (size_t)pd->accum_gap.height * pd->accum_gap.len *
+		       sizeof(u32);
+		if (ac.length != size)
+			return CE_BAD_PARAMETER;
+		if (copy_to_user((u32 __user *)ac.dest, pd->accum, size))
+			return -EFAULT;
+		ac.frames = pd->accum_frames;
+		if (put_user(ac.frames,
+			     &((struct sbig_accumulate __user *)arg)->frames))
+			return -EFAULT;
+		sbig_stat_bytes(pd->sd, 0, size);
+		sbig_status_add(pd->sd, 0, 0, 0, size);
+		memset(pd->accum, 0, size);
+		pd->accum_frames = 0;
+		break;
+	case SBIG_ACCUM_STOP:
+		vfree(pd->accum);
+		pd->accum = NULL;
+		break;
+	default:
+		return CE_BAD_PARAMETER;
+	}
+	return CE_NO_ERROR;
+}
+//========================================================================
+// KLptIdleClear
+// Start or stop clearing a CCD while the port is idle.
+//========================================================================
+int KLptIdleClear(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_idle_clear ic;
+
+	if (copy_from_user(&ic, (struct sbig_idle_clear __user *)arg,
+			   sizeof(ic)))
+		return -EFAULT;
+	if (ic.ccd != CCD_IMAGING && (ic.ccd != CCD_TRACKING ||
+	    ic.cameraID == ST5C_CAMERA || ic.cameraID == ST237_CAMERA))
+		return CE_BAD_PARAMETER;
+	return sbig_idle_arm(pd->sd, &ic);
+}
+//========================================================================
+// KLptGuideWait
+// Sleep until deadline_ns between steps of IOCTL_GUIDE_STREAM, which
+// ends on IOCTL_CANCEL or a signal.
+//========================================================================
+static int KLptGuideWait(struct sbig_client *pd, int cancel_seq,
+			 u64 deadline_ns)
+{
+	do {
+		if (READ_ONCE(pd->sd->sched.dead))
+			return -ENODEV;
+		if (atomic_read(&pd->cancel_seq) != cancel_seq)
+			return -ECANCELED;
+		if (signal_pending(current))
+			return -EINTR;
+	} while (sbig_wait_until(deadline_ns));
+	return 0;
+}
+//========================================================================
+// KLptPortStep
+// Run a step of IOCTL_GUIDE_STREAM or IOCTL_TIMED_MICRO_BLOCK as a guide
+// command.  The frame is passed as the argument of a port command that
+// never comes from user space, see sbig_port_ioctl().
+//========================================================================
+static int KLptPortStep(struct sbig_client *pd, unsigned int cmd, void *f)
+{
+	int status;
+
+	status = sbig_sched_begin(pd, SBIG_CLASS_GUIDE);
+	if (status < 0)
+		return status;
+	pd->sd->policy = READ_ONCE(pd->sd->readout_policy);
+	status = sbig_worker_call(pd, cmd, (unsigned long)f);
+	sbig_sched_end(pd);
+	return status;
+}
+//========================================================================
+// KLptGuideStream
+// Clear, integrate and read a region of the tracking CCD over and over,
+// queueing its centroid for read(), see guide.c.  The port is only held
+// for the clear and the read.
+//========================================================================
+int KLptGuideStream(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_guide_stream gs;
+	const struct ioc_get_area_params *gap = &gs.gap;
+	struct sbig_guide_frame f = { .gs = &gs };
+	struct sbig_guide_record rec;
+	u64 t0, exposure_ns, late_ns;
+	size_t bytes;
+	u16 *pixels;
+	int cancel_seq = atomic_read(&pd->cancel_seq);
+	int status;
+	u32 i;
+
+	if (copy_from_user(&gs, (struct sbig_guide_stream __user *)arg,
+			   sizeof(gs))) {
+		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
+		return -EFAULT;
+	}
+	if (gap->ccd != CCD_TRACKING || gap->cameraID == ST5C_CAMERA ||
+	    gap->cameraID == ST237_CAMERA || gap->len < 3 ||
+	    gap->height < 3 || gs.queue == 0 ||
+	    gap->len * gap->height > SBIG_GUIDE_MAX_PIXELS)
+		return CE_BAD_PARAMETER;
+	bytes = (size_t)gap->len * gap->height * sizeof(u16);
+	pixels = kvmalloc(bytes, GFP_KERNEL);
+	if (!pixels)
+		return -ENOMEM;
+	status = sbig_guide_begin(pd, &gs);
+	if (status != CE_NO_ERROR)
+		goto out_free;
+
+	exposure_ns = (u64)gs.exposure_us * NSEC_PER_USEC;
+	t0 = ktime_get_ns();
+	for (i = 0; gs.count == 0 || i < gs.count; i++) {
+		status = KLptGuideWait(pd, cancel_seq, t0 +
+				       (u64)i * gs.period_us * NSEC_PER_USEC);
+		if (status < 0)
+			break;
+
+		memset(&rec, 0, sizeof(rec));
+		rec.seq = i;
+		rec.x = rec.y = -1;
+		late_ns = 0;
+		f.pixels = NULL;
+		status = KLptPortStep(pd, IOCTL_GUIDE_STREAM, &f);
+		if (status < 0)
+			break;
+		rec.start_ns = f.t_ns;
+		if (status == CE_NO_ERROR) {
+			status = KLptGuideWait(pd, cancel_seq,
+					       rec.start_ns + exposure_ns);
+			if (status < 0)
+				break;
+			f.pixels = pixels;
+			status = KLptPortStep(pd, IOCTL_GUIDE_STREAM, &f);
+			if (status < 0)
+				break;
+			rec.end_ns = f.t_ns;
+			late_ns = rec.end_ns - rec.start_ns - exposure_ns;
+		}
+		if (status == CE_NO_ERROR)
+			sbig_guide_centroid(pixels, gap->len, gap->height,
+					    &rec);
+		else
+			memset(pixels, 0, bytes);
+		rec.status = status;
+		sbig_guide_push(pd, &rec, pixels, late_ns);
+	}
+	sbig_guide_end(pd);
+	if (status == -ECANCELED)
+		status = CE_NO_ERROR;
+out_free:
+	kvfree(pixels);
+	return status;
+}
+//========================================================================
+// KLptTimedMicroBlock
+// Send a micro block at a deadline, see micro.c.  The port is taken
+// micro_lead_us ahead of it, and the reply is left for
+// IOCTL_GET_MICRO_BLOCK.
+//========================================================================
+int KLptTimedMicroBlock(struct sbig_client *pd, unsigned long arg)
+{
+	struct sbig_timed_micro tm;
+	struct sbig_micro_frame f = { 0 };
+	u64 lead_ns = (u64)READ_ONCE(pd->sd->micro.lead_us) * NSEC_PER_USEC;
+	int cancel_seq = atomic_read(&pd->cancel_seq);
+	u8 *data;
+	int status;
+
+	if (copy_from_user(&tm, (struct sbig_timed_micro __user *)arg,
+			   sizeof(tm))) {
+		sbig_err(pd, "%s: copy_from_user: error\n", __func__);
+		return -EFAULT;
+	}
+	if (tm.length == 0 || tm.length > pd->buffer_size ||
+	    (tm.clock != CLOCK_MONOTONIC && tm.clock != CLOCK_REALTIME))
+		return CE_BAD_PARAMETER;
+	data = memdup_user((u8 __user *)tm.data, tm.length);
+	if (IS_ERR(data))
+		return PTR_ERR(data);
+	sbig_stat_bytes(pd->sd, tm.length, 0);
+
+	f.data = data;
+	f.length = tm.length;
+	f.clock = tm.clock;
+	f.deadline_ns = tm.deadline_ns;
+	lead_ns = min(lead_ns, tm.deadline_ns);
+	do {
+		status = -ENODEV;
+		if (READ_ONCE(pd->sd->sched.dead))
+			goto out;
+		status = -ECANCELED;
+		if (atomic_read(&pd->cancel_seq) != cancel_seq)
+			goto out;
+		status = -EINTR;
+		if (signal_pending(current))
+			goto out;
+	} while (sbig_micro_wait(tm.clock, tm.deadline_ns - lead_ns));
+
+	status = KLptPortStep(pd, IOCTL_TIMED_MICRO_BLOCK, &f);
+	if (status < 0)
+		goto out;
+	tm.start_ns = f.start_ns;
+	tm.end_ns = f.end_ns;
+	tm.error_ns = (s64)(f.start_ns - tm.deadline_ns);
+	sbig_micro_account(pd->sd, tm.error_ns);
+	if (copy_to_user((struct sbig_timed_micro __user *)arg, &tm,
+			 sizeof(tm))) {
+		sbig_err(pd, "%s: copy_to_user: error\n", __func__);
+		status = -EFAULT;
+	}
+out:
+	kfree(data);
+	return status;
+}
+//========================================================================
 // KLptGetJiffies
 // Get jiffies, ie. number of ticks from the boot time.
 //========================================================================
@@ -1369,19 +2717,89 @@ int KSbigLptGetLastError(struct sbig_client *pd, unsigned long arg)
 	return CE_NO_ERROR;
 }
 //========================================================================
-// sbig_ioctl - entry point
+// KLptIoctlUsesPort
+// Return TRUE if the command drives the parallel port.
 //========================================================================
-long sbig_ioctl(struct sbig_client *pd, unsigned int cmd, unsigned long arg,
-		spinlock_t *spin_lock)
+static bool KLptIoctlUsesPort(unsigned int cmd)
 {
-	int status = CE_NO_ERROR;
+	switch (cmd) {
+	case IOCTL_INIT_PORT:
+	case IOCTL_CAMERA_OUT:
+	case IOCTL_SEND_MICRO_BLOCK:
+	case IOCTL_GET_MICRO_BLOCK:
+	case IOCTL_SET_VDD:
+	case IOCTL_CLEAR_IMAG_CCD:
+	case IOCTL_CLEAR_TRAC_CCD:
+	case IOCTL_GET_PIXELS:
+	case IOCTL_GET_AREA:
+	case IOCTL_GET_AREA_STATS:
+	case IOCTL_GET_PREVIEW:
+	case IOCTL_GET_ROIS:
+	case IOCTL_ACCUMULATE:
+	case IOCTL_TDI_SCAN:
+	case IOCTL_DUMP_ILINES:
+	case IOCTL_DUMP_TLINES:
+	case IOCTL_DUMP_5LINES:
+	case IOCTL_CLOCK_AD:
+	case IOCTL_AUTOTUNE:
+		return true;
+	default:
+		return false;
+	}
+}
+//========================================================================
+// KLptIoctlClass
+// Pick the scheduling class of a port command.  Readouts are classed
+// by the CCD they read, so the parameters are peeked at here.
+//========================================================================
+static enum sbig_class KLptIoctlClass(unsigned int cmd, unsigned long arg)
+{
+	struct ioc_get_pixels_params gpp;
+	struct ioc_get_area_params gap;
 
-	if (_IOC_TYPE(cmd) != IOCTL_BASE) {
-		sbig_err(pd, "%s: error: IOCTL base %d, must be %d\n",
-			 __func__, _IOC_TYPE(cmd), IOCTL_BASE);
-		status = -ENOTTY;
-		goto out_last_error;
+	switch (cmd) {
+	case IOCTL_SEND_MICRO_BLOCK:
+	case IOCTL_GET_MICRO_BLOCK:
+	case IOCTL_CLEAR_TRAC_CCD:
+	case IOCTL_DUMP_TLINES:
+		return SBIG_CLASS_GUIDE;
+	case IOCTL_GET_PIXELS:
+		if (copy_from_user(&gpp, (void __user *)arg, sizeof(gpp)) == 0
+		    && gpp.ccd != CCD_IMAGING)
+			return SBIG_CLASS_GUIDE;
+		return SBIG_CLASS_IMAGING;
+	case IOCTL_GET_AREA:
+	case IOCTL_GET_AREA_STATS:
+	case IOCTL_GET_PREVIEW:
+	case IOCTL_GET_ROIS:
+		if (copy_from_user(&gap, (void __user *)arg, sizeof(gap)) == 0
+		    && gap.ccd != CCD_IMAGING)
+			return SBIG_CLASS_GUIDE;
+		return SBIG_CLASS_IMAGING;
+	default:
+		return SBIG_CLASS_IMAGING;
 	}
+}
+//========================================================================
+// sbig_port_ioctl
+// Commands that drive the port.  The caller owns the port, and this
+// runs on the readout thread if there is one.
+//========================================================================
+long sbig_port_ioctl(struct sbig_client *pd, unsigned int cmd,
+		     unsigned long arg)
+{
+	struct sbig_device *sd = pd->sd;
+	struct sbig_progress saved = {
+		.cmd = sd->progress_cmd,
+		.row = sd->progress_row,
+		.total = sd->progress_total,
+	};
+	int cancel_start = pd->cancel_start;
+	int status = CE_NO_ERROR;
+	u8 rec_cmd = sbig_rec_command(sd, _IOC_NR(cmd));
+
+	pd->cancel_start = atomic_read(&pd->cancel_seq);
+	KLptProgress(pd, 0, 0, 0);
 
 	switch (cmd) {
 	case IOCTL_INIT_PORT:
@@ -1394,10 +2812,13 @@ long sbig_ioctl(struct sbig_client *pd, unsigned int cmd, unsigned long arg,
 
 	case IOCTL_SEND_MICRO_BLOCK:
 		status = KLptSendMicroBlock(pd, arg);
+		if (status == CE_NO_ERROR)
+			sbig_sched_hold_micro(pd);
 		break;
 
 	case IOCTL_GET_MICRO_BLOCK:
 		status = KLptGetMicroBlock(pd, arg);
+		sbig_sched_release_micro(pd);
 		break;
 
 	case IOCTL_SET_VDD:
@@ -1420,18 +2841,6 @@ long sbig_ioctl(struct sbig_client *pd, unsigned int cmd, unsigned long arg,
 		status = KLptGetArea(pd, arg);
 		break;
 
-	case IOCTL_GET_JIFFIES:
-		status = KLptGetJiffies(pd, arg);
-		break;
-
-	case IOCTL_GET_HZ:
-		status = KLptGetHz(pd, arg);
-		break;
-
-	case IOCTL_GET_LAST_ERROR:
-		status = KSbigLptGetLastError(pd, arg);
-		break;
-
 	case IOCTL_DUMP_ILINES:
 		status = KLptDumpImagingLines(pd, arg);
 		break;
@@ -1448,6 +2857,95 @@ long sbig_ioctl(struct sbig_client *pd, unsigned int cmd, unsigned long arg,
 		status = KLptClockAD(pd, arg);
 		break;
 
+	case IOCTL_GET_AREA_STATS:
+		status = KLptGetAreaStats(pd, arg);
+		break;
+
+	case IOCTL_GET_PREVIEW:
+		status = KLptGetPreview(pd, arg);
+		break;
+
+	case IOCTL_GET_ROIS:
+		status = KLptGetRois(pd, arg);
+		break;
+
+	case IOCTL_ACCUMULATE:
+		status = KLptAccumulate(pd, arg);
+		break;
+
+	case IOCTL_TDI_SCAN:
+		status = KLptTdiScan(pd, arg);
+		break;
+
+	case IOCTL_GUIDE_STREAM:
+		status = KLptGuideFrame(pd, (struct sbig_guide_frame *)arg);
+		break;
+
+	case IOCTL_TIMED_MICRO_BLOCK:
+		status = KLptTimedMicroSend(pd, (struct sbig_micro_frame *)arg);
+		if (status == CE_NO_ERROR)
+			sbig_sched_hold_micro(pd);
+		break;
+
+	case IOCTL_AUTOTUNE:
+		status = KLptAutoTune(pd, arg);
+		break;
+
+	default:
+		status = -ENOTTY;
+		break;
+	}
+
+	sbig_rec_status(sd, status);
+	if (status > 0)
+		sbig_status_error(sd, status);
+
+	// a guide command may have run while a readout yielded
+	KLptProgress(pd, saved.cmd, saved.row, saved.total);
+	pd->cancel_start = cancel_start;
+	sbig_rec_command(sd, rec_cmd);
+	return status;
+}
+//========================================================================
+// sbig_ioctl - entry point
+//========================================================================
+long sbig_ioctl(struct sbig_client *pd, unsigned int cmd, unsigned long arg)
+{
+	int status = CE_NO_ERROR;
+	u64 t0 = ktime_get_ns();
+
+	trace_sbig_ioctl_enter(pd->sd->minor, cmd, arg);
+
+	if (_IOC_TYPE(cmd) != IOCTL_BASE) {
+		sbig_err(pd, "%s: error: IOCTL base %d, must be %d\n",
+			 __func__, _IOC_TYPE(cmd), IOCTL_BASE);
+		status = -ENOTTY;
+		goto out_last_error;
+	}
+
+	if (KLptIoctlUsesPort(cmd)) {
+		status = sbig_sched_begin(pd, KLptIoctlClass(cmd, arg));
+		if (status < 0)
+			goto out;
+		pd->sd->policy = READ_ONCE(pd->sd->readout_policy);
+		status = sbig_worker_call(pd, cmd, arg);
+		sbig_sched_end(pd);
+		goto out_last_error;
+	}
+
+	switch (cmd) {
+	case IOCTL_GET_JIFFIES:
+		status = KLptGetJiffies(pd, arg);
+		break;
+
+	case IOCTL_GET_HZ:
+		status = KLptGetHz(pd, arg);
+		break;
+
+	case IOCTL_GET_LAST_ERROR:
+		status = KSbigLptGetLastError(pd, arg);
+		break;
+
 	case IOCTL_GET_DRIVER_INFO:
 		status = KLptGetDriverInfo(pd, arg);
 		break;
@@ -1457,7 +2955,7 @@ long sbig_ioctl(struct sbig_client *pd, unsigned int cmd, unsigned long arg,
 		break;
 
 	case IOCTL_SET_BUFFER_SIZE:
-		status = KLptSetBufferSize(pd, spin_lock, arg);
+		status = KLptSetBufferSize(pd, arg);
 		if (status > 0)
 			goto out;
 		break;
@@ -1472,6 +2970,30 @@ long sbig_ioctl(struct sbig_client *pd, unsigned int cmd, unsigned long arg,
 		status = KLptTestCommand(pd);
 		break;
 
+	case IOCTL_CANCEL:
+		atomic_inc(&pd->cancel_seq);
+		break;
+
+	case IOCTL_GET_PROGRESS:
+		status = KLptGetProgress(pd, arg);
+		break;
+
+	case IOCTL_PREDICT_AREA:
+		status = KLptPredict(pd, arg);
+		break;
+
+	case IOCTL_IDLE_CLEAR:
+		status = KLptIdleClear(pd, arg);
+		break;
+
+	case IOCTL_GUIDE_STREAM:
+		status = KLptGuideStream(pd, arg);
+		break;
+
+	case IOCTL_TIMED_MICRO_BLOCK:
+		status = KLptTimedMicroBlock(pd, arg);
+		break;
+
 	default:
 		sbig_err(pd, "undefined ioctl (%d)\n", cmd);
 		status = -ENOTTY;
@@ -1484,6 +3006,12 @@ out_last_error:
 	else if (status != CE_NO_ERROR)
 		pd->last_error = status;
 out:
+	if (cmd == IOCTL_CLEAR_IMAG_CCD || cmd == IOCTL_CLEAR_TRAC_CCD)
+		sbig_idle_latency(pd->sd, cmd == IOCTL_CLEAR_IMAG_CCD ?
+				  CCD_IMAGING : CCD_TRACKING,
+				  ktime_get_ns() - t0);
+	sbig_stat_ioctl(pd->sd, _IOC_NR(cmd), ktime_get_ns() - t0);
+	trace_sbig_ioctl_exit(pd->sd->minor, cmd, status);
 	return status;
 }
 //========================================================================
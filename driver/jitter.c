@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver pixel cadence
+ *
+ * Uneven spacing of A/D triggers within a row shows up as pattern noise.
+ * With pixel_jitter_ns set, each IOCTL_GET_AREA timestamps every trigger
+ * with ktime_get_ns() and keeps a log2 histogram of the intervals, and
+ * rows whose longest interval exceeds pixel_jitter_ns are flagged.  The
+ * last frame is kept in /sys/kernel/debug/sbiglpt/sbiglptN/jitter with
+ * a sequence number, and flagged rows are also traced as sbig_row_jitter
+ * so they can be lined up with interrupts, SMIs and the like.
+ *
+ * Intervals across row boundaries are not counted; they include the
+ * vertical clock and left clears.  The frame in progress is kept on the
+ * client, so a guide command let in between rows times its own.  0
+ * turns it off and costs one test per pixel.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "sbiglpt_module.h"
+
+// Call before the first row of a frame.
+void sbig_jitter_begin(struct sbig_client *pd)
+{
+	unsigned int threshold_ns = READ_ONCE(pd->sd->jitter.threshold_ns);
+
+	pd->jitter_active = threshold_ns != 0;
+	if (!pd->jitter_active)
+		return;
+	memset(&pd->jitter, 0, sizeof(pd->jitter));
+	pd->jitter.threshold_ns = threshold_ns;
+}
+
+// Account a row's longest interval.  Returns true if it is flagged.
+bool sbig_jitter_row(struct sbig_client *pd, u32 row, u64 max_ns)
+{
+	struct sbig_jitter_frame *f = &pd->jitter;
+
+	f->rows++;
+	if (f->max_ns < max_ns) {
+		f->max_ns = max_ns;
+		f->max_row = row;
+	}
+	if (max_ns <= f->threshold_ns)
+		return false;
+	if (f->flagged < SBIG_JITTER_ROWS) {
+		f->row[f->flagged].row = row;
+		f->row[f->flagged].max_ns = min_t(u64, max_ns, U32_MAX);
+	}
+	f->flagged++;
+	return true;
+}
+
+// Call when the frame is done or abandoned, to publish it.
+void sbig_jitter_end(struct sbig_client *pd, int status)
+{
+	struct sbig_jitter *j = &pd->sd->jitter;
+
+	if (!pd->jitter_active)
+		return;
+	pd->jitter_active = false;
+	pd->jitter.status = status;
+	spin_lock(&j->lock);
+	pd->jitter.seq = ++j->seq;
+	j->last = pd->jitter;
+	spin_unlock(&j->lock);
+}
+
+static int sbig_jitter_show(struct seq_file *m, void *v)
+{
+	struct sbig_device *sd = m->private;
+	struct sbig_jitter_frame *f;
+	int b, i;
+
+	f = kmalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+	spin_lock(&sd->jitter.lock);
+	*f = sd->jitter.last;
+	spin_unlock(&sd->jitter.lock);
+
+	seq_printf(m, "frame %llu status %d rows %u threshold_ns %u\n",
+		   f->seq, f->status, f->rows, f->threshold_ns);
+	seq_printf(m, "intervals %llu max_ns %llu row %u flagged %u\n",
+		   f->intervals, f->max_ns, f->max_row, f->flagged);
+	// bucket b > 0 holds [2^(b-1), 2^b) ns
+	for (b = 0; b < SBIG_JITTER_BUCKETS; b++) {
+		if (f->hist[b] == 0)
+			continue;
+		if (b == SBIG_JITTER_BUCKETS - 1)
+			seq_printf(m, "  >= %llu ns %u\n", 1ULL << (b - 1),
+				   f->hist[b]);
+		else
+			seq_printf(m, "  < %llu ns %u\n", 1ULL << b,
+				   f->hist[b]);
+	}
+	for (i = 0; i < min_t(u32, f->flagged, SBIG_JITTER_ROWS); i++)
+		seq_printf(m, "row %u max_ns %u\n", f->row[i].row,
+			   f->row[i].max_ns);
+	kfree(f);
+	return 0;
+}
+
+static int sbig_jitter_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sbig_jitter_show, inode->i_private);
+}
+
+static const struct file_operations sbig_jitter_fops = {
+	.owner = THIS_MODULE,
+	.open = sbig_jitter_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+// Publish the last frame next to the statistics.
+void sbig_jitter_add(struct sbig_device *sd)
+{
+	if (sd->debugfs)
+		debugfs_create_file("jitter", 0444, sd->debugfs, sd,
+				    &sbig_jitter_fops);
+}
+
+static ssize_t pixel_jitter_ns_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 READ_ONCE(sd->jitter.threshold_ns));
+}
+
+static ssize_t pixel_jitter_ns_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	unsigned int val;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &val);
+	if (rc < 0)
+		return rc;
+	WRITE_ONCE(sd->jitter.threshold_ns, val);
+	return count;
+}
+static DEVICE_ATTR_RW(pixel_jitter_ns);
+
+static struct attribute *sbig_jitter_attrs[] = {
+	&dev_attr_pixel_jitter_ns.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_jitter_group = {
+	.attrs = sbig_jitter_attrs,
+};
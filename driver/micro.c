@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver micro blocks sent on time
+ *
+ * Exposures start and end with micro commands, sent whenever the
+ * application gets to its ioctl, so scheduling delays end up in the
+ * exposure time.  IOCTL_TIMED_MICRO_BLOCK sends a block at a deadline
+ * on CLOCK_MONOTONIC or CLOCK_REALTIME instead.
+ *
+ * The nibble handshake polls the camera and can't be done from an
+ * hrtimer callback.  The caller sleeps until micro_lead_us before the
+ * deadline and takes the port as a guide command, which may have to wait
+ * for a readout row.  The readout thread then sleeps on an hrtimer until
+ * micro_spin_us before the deadline and spins the rest, so the start of
+ * the handshake only depends on the hrtimer being late by less than
+ * micro_spin_us.  micro_timed shows the errors of the blocks sent, and
+ * how many were later than micro_spin_us.
+ */
+
+#include <linux/device.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/processor.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include "sbiglpt_module.h"
+
+#define SBIG_MICRO_LEAD_US	20000
+#define SBIG_MICRO_SPIN_US	50
+
+void sbig_micro_init(struct sbig_device *sd)
+{
+	spin_lock_init(&sd->micro.lock);
+	sd->micro.lead_us = SBIG_MICRO_LEAD_US;
+	sd->micro.spin_us = SBIG_MICRO_SPIN_US;
+}
+
+u64 sbig_micro_now(clockid_t clock)
+{
+	return clock == CLOCK_REALTIME ? ktime_get_real_ns() : ktime_get_ns();
+}
+
+/* Sleep towards deadline_ns on clock.  Returns TRUE if it is still ahead,
+ * see sbig_wait_until().  CLOCK_REALTIME is followed across steps at
+ * each wakeup.
+ */
+bool sbig_micro_wait(clockid_t clock, u64 deadline_ns)
+{
+	u64 now = sbig_micro_now(clock);
+
+	if (now >= deadline_ns)
+		return false;
+	sbig_wait_until(ktime_get_ns() + deadline_ns - now);
+	return sbig_micro_now(clock) < deadline_ns;
+}
+
+/* Spin until deadline_ns on clock, for at most spin_ns.  The time left
+ * is read once and the spin runs on CLOCK_MONOTONIC, so a step of
+ * CLOCK_REALTIME meanwhile can't make it spin for long.
+ */
+void sbig_micro_spin(clockid_t clock, u64 deadline_ns, u64 spin_ns)
+{
+	u64 now = sbig_micro_now(clock);
+	u64 end;
+
+	if (now >= deadline_ns)
+		return;
+	end = ktime_get_ns() + min(deadline_ns - now, spin_ns);
+	while (ktime_get_ns() < end)
+		cpu_relax();
+}
+
+// Account a block sent error_ns after its deadline.
+void sbig_micro_account(struct sbig_device *sd, s64 error_ns)
+{
+	struct sbig_micro *m = &sd->micro;
+	struct sbig_micro_stats *st = &m->st;
+
+	spin_lock(&m->lock);
+	if (st->count == 0)
+		st->min_error_ns = st->max_error_ns = error_ns;
+	st->count++;
+	if (error_ns > (s64)m->spin_us * NSEC_PER_USEC)
+		st->late++;
+	st->last_error_ns = error_ns;
+	st->abs_error_ns += error_ns < 0 ? -error_ns : error_ns;
+	st->min_error_ns = min(st->min_error_ns, error_ns);
+	st->max_error_ns = max(st->max_error_ns, error_ns);
+	spin_unlock(&m->lock);
+}
+
+static ssize_t micro_timed_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_micro_stats st;
+
+	spin_lock(&sd->micro.lock);
+	st = sd->micro.st;
+	spin_unlock(&sd->micro.lock);
+
+	return scnprintf(buf, PAGE_SIZE,
+			 "count %llu late %llu last_ns %lld mean_abs_ns %llu min_ns %lld max_ns %lld\n",
+			 st.count, st.late, st.last_error_ns,
+			 st.count ? div64_u64(st.abs_error_ns, st.count) : 0,
+			 st.min_error_ns, st.max_error_ns);
+}
+static DEVICE_ATTR_RO(micro_timed);
+
+#define SBIG_MICRO_ATTR(name, field)					\
+static ssize_t name##_show(struct device *dev,				\
+			   struct device_attribute *attr, char *buf)	\
+{									\
+	struct sbig_device *sd = dev_get_drvdata(dev);			\
+									\
+	return scnprintf(buf, PAGE_SIZE, "%u\n",			\
+			 READ_ONCE(sd->micro.field));			\
+}									\
+static ssize_t name##_store(struct device *dev,				\
+			    struct device_attribute *attr,		\
+			    const char *buf, size_t count)		\
+{									\
+	struct sbig_device *sd = dev_get_drvdata(dev);			\
+	unsigned int val;						\
+	int rc;								\
+									\
+	rc = kstrtouint(buf, 0, &val);					\
+	if (rc < 0)							\
+		return rc;						\
+	WRITE_ONCE(sd->micro.field, val);				\
+	return count;							\
+}									\
+static DEVICE_ATTR_RW(name)
+
+SBIG_MICRO_ATTR(micro_lead_us, lead_us);
+SBIG_MICRO_ATTR(micro_spin_us, spin_us);
+
+static struct attribute *sbig_micro_attrs[] = {
+	&dev_attr_micro_lead_us.attr,
+	&dev_attr_micro_spin_us.attr,
+	&dev_attr_micro_timed.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_micro_group = {
+	.attrs = sbig_micro_attrs,
+};
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver readout time model
+ *
+ * Every row read measures what its vertical clocks, PLD clears and
+ * pixel digitizing cost on this port, per CCD.  The costs are moving
+ * averages, so they follow the port backend, CPU frequency and readout
+ * policy.  IOCTL_PREDICT_AREA uses them to tell how long a readout will
+ * take on the port, not counting commands of other clients let in
+ * between rows.
+ *
+ * Each IOCTL_GET_AREA compares its prediction with the time its rows
+ * took, and readout_model in sysfs shows the costs and how wrong the
+ * predictions were.  Writing it starts the model afresh.
+ */
+
+#include <linux/device.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include "sbiglpt_module.h"
+
+#define SBIG_MODEL_SHIFT	8	// fixed point fraction bits
+#define SBIG_MODEL_WEIGHT	3	// each sample counts 1/8
+
+static const char *sbig_model_ccd_names[SBIG_MODEL_CCDS] = {
+	"imaging", "tracking",
+};
+
+static void sbig_model_ewma(u64 *cost, u64 ns, u32 units)
+{
+	u64 x;
+
+	if (units == 0)
+		return;
+	x = div_u64(ns << SBIG_MODEL_SHIFT, units);
+	if (*cost == 0)
+		*cost = x;
+	else
+		*cost = *cost - (*cost >> SBIG_MODEL_WEIGHT) +
+			(x >> SBIG_MODEL_WEIGHT);
+}
+
+// Account a row of lines vertical clocks, clears and pixels digitized.
+void sbig_model_row(struct sbig_device *sd, int ccd, u32 lines,
+		    u64 vclock_ns, u32 clears, u64 clear_ns, u32 pixels,
+		    u64 pixel_ns)
+{
+	struct sbig_model *m = &sd->model;
+	struct sbig_model_costs *c = &m->ccd[ccd != 0];
+
+	spin_lock(&m->lock);
+	sbig_model_ewma(&c->vclock, vclock_ns, lines);
+	sbig_model_ewma(&c->clear, clear_ns, clears);
+	sbig_model_ewma(&c->pixel, pixel_ns, pixels);
+	c->rows++;
+	spin_unlock(&m->lock);
+}
+
+// Predict a row's time, or 0 if no such row was measured yet.
+u64 sbig_model_predict(struct sbig_device *sd, int ccd, u32 lines,
+		       u32 clears, u32 pixels)
+{
+	struct sbig_model *m = &sd->model;
+	struct sbig_model_costs c;
+
+	spin_lock(&m->lock);
+	c = m->ccd[ccd != 0];
+	spin_unlock(&m->lock);
+	if (c.rows == 0)
+		return 0;
+	return (c.vclock * lines + c.clear * clears + c.pixel * pixels) >>
+		SBIG_MODEL_SHIFT;
+}
+
+void sbig_model_error(struct sbig_device *sd, u64 predicted_ns,
+		      u64 actual_ns)
+{
+	struct sbig_model *m = &sd->model;
+	s64 err = (s64)(predicted_ns - actual_ns);
+	u64 abs_err = err < 0 ? -err : err;
+
+	if (predicted_ns == 0 || actual_ns == 0)
+		return;
+	spin_lock(&m->lock);
+	m->predictions++;
+	m->err_ns += err;
+	m->abs_err_ns += abs_err;
+	m->abs_err_permille += div64_u64(abs_err * 1000, actual_ns);
+	if (m->max_abs_err_ns < abs_err)
+		m->max_abs_err_ns = abs_err;
+	spin_unlock(&m->lock);
+}
+
+// ns with two decimals from a fixed point cost
+static ssize_t sbig_model_cost(char *buf, ssize_t len, const char *name,
+			       u64 cost)
+{
+	u64 ns = cost >> SBIG_MODEL_SHIFT;
+	u32 frac = ((cost & ((1 << SBIG_MODEL_SHIFT) - 1)) * 100) >>
+		   SBIG_MODEL_SHIFT;
+
+	return scnprintf(buf + len, PAGE_SIZE - len, " %s_ns %llu.%02u",
+			 name, ns, frac);
+}
+
+static ssize_t readout_model_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_model *m = &sd->model;
+	struct sbig_model_costs c[SBIG_MODEL_CCDS];
+	u64 n, abs_err, permille, max_abs;
+	s64 err;
+	ssize_t len = 0;
+	int i;
+
+	spin_lock(&m->lock);
+	memcpy(c, m->ccd, sizeof(c));
+	n = m->predictions;
+	err = m->err_ns;
+	abs_err = m->abs_err_ns;
+	permille = m->abs_err_permille;
+	max_abs = m->max_abs_err_ns;
+	spin_unlock(&m->lock);
+
+	for (i = 0; i < SBIG_MODEL_CCDS; i++) {
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s rows %llu",
+				 sbig_model_ccd_names[i], c[i].rows);
+		len += sbig_model_cost(buf, len, "vclock", c[i].vclock);
+		len += sbig_model_cost(buf, len, "clear", c[i].clear);
+		len += sbig_model_cost(buf, len, "pixel", c[i].pixel);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			 "predictions %llu bias_ns %lld mean_abs_ns %llu max_abs_ns %llu mean_abs_permille %llu\n",
+			 n, n ? div64_s64(err, n) : 0,
+			 n ? div64_u64(abs_err, n) : 0, max_abs,
+			 n ? div64_u64(permille, n) : 0);
+	return len;
+}
+
+// Any write forgets the costs and errors.
+static ssize_t readout_model_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_model *m = &sd->model;
+
+	spin_lock(&m->lock);
+	memset(m->ccd, 0, sizeof(m->ccd));
+	m->predictions = 0;
+	m->err_ns = 0;
+	m->abs_err_ns = 0;
+	m->abs_err_permille = 0;
+	m->max_abs_err_ns = 0;
+	spin_unlock(&m->lock);
+	return count;
+}
+static DEVICE_ATTR_RW(readout_model);
+
+static struct attribute *sbig_model_attrs[] = {
+	&dev_attr_readout_model.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_model_group = {
+	.attrs = sbig_model_attrs,
+};
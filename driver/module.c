@@ -13,62 +13,102 @@
 
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/fs.h>
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/cdev.h>
+#include <linux/idr.h>
+#include <linux/mutex.h>
 #include <linux/parport.h>
 
 #include "sbiglpt_module.h"
 
 #define DEFAULT_BUFFER_SIZE 4096 // user space may request realloc
 
-#define SBIG_NO 3
-static struct {
-	struct pardevice *pardev;
-	struct device *dev;
-	spinlock_t spinlock;
-} sbig_table[SBIG_NO];
-static unsigned int sbig_count;
+// minor number -> struct sbig_device
+static DEFINE_IDR(sbig_idr);
+static DEFINE_MUTEX(sbig_idr_lock);
+
+static const struct attribute_group *sbig_groups[] = {
+	&sbig_guide_group,
+	&sbig_idle_group,
+	&sbig_jitter_group,
+	&sbig_micro_group,
+	&sbig_model_group,
+	&sbig_recorder_group,
+	&sbig_sched_group,
+	&sbig_stats_group,
+	&sbig_tdi_group,
+	&sbig_timing_group,
+	&sbig_wait_group,
+	&sbig_worker_group,
+	NULL,
+};
 
 static dev_t sbig_dev;
 static struct class *sbig_class;
 static struct cdev sbig_cdev;
 
+static void sbig_device_free(struct kref *kref)
+{
+	struct sbig_device *sd = container_of(kref, struct sbig_device, kref);
+
+	put_device(sd->dev);
+	sbig_stats_free(sd);
+	sbig_rec_free(sd);
+	sbig_status_free(sd);
+	sbig_idle_free(sd);
+	mutex_destroy(&sd->lock);
+	kfree(sd);
+}
+
+static struct sbig_device *sbig_device_get(unsigned int minor)
+{
+	struct sbig_device *sd;
+
+	mutex_lock(&sbig_idr_lock);
+	sd = idr_find(&sbig_idr, minor);
+	if (sd)
+		kref_get(&sd->kref);
+	mutex_unlock(&sbig_idr_lock);
+	return sd;
+}
+
+static void sbig_device_put(struct sbig_device *sd)
+{
+	kref_put(&sd->kref, sbig_device_free);
+}
+
 static int sbig_open(struct inode *inode, struct file *file)
 {
 	unsigned int minor = MINOR(inode->i_rdev);
-	struct sbig_client *pd = file->private_data;
-	int rc = 0;
+	struct sbig_device *sd;
+	struct sbig_client *pd;
 
-	if (minor >= sbig_count) {
-		rc = -ENODEV;
-		goto out;
-	}
-	spin_lock(&sbig_table[minor].spinlock);
-	if (pd) {
-		rc = -EBUSY;
-		goto out_unlock;
-	}
-	pd = kmalloc(sizeof(*pd), GFP_KERNEL);
-	if (!pd) {
-		rc = -ENOMEM;
-		goto out_unlock;
-	}
+	// several clients may share a device - see sched.c
+	sd = sbig_device_get(minor);
+	if (!sd)
+		return -ENODEV;
+	pd = kzalloc(sizeof(*pd), GFP_KERNEL);
+	if (!pd)
+		goto out_nomem;
 	pd->buffer = kzalloc(DEFAULT_BUFFER_SIZE, GFP_KERNEL);
 	if (!pd->buffer) {
 		kfree(pd);
-		rc = -ENOMEM;
-		goto out_unlock;
+		goto out_nomem;
 	}
 	pd->buffer_size = DEFAULT_BUFFER_SIZE;
-	pd->port = sbig_table[minor].pardev->port;
-	pd->dev = sbig_table[minor].dev;
+	pd->sd = sd;
+	pd->port = pd->sd->port;
+	pd->dev = pd->sd->dev;
+	sbig_tdi_open(pd);
+	sbig_guide_open(pd);
 	file->private_data = pd;
-out_unlock:
-	spin_unlock(&sbig_table[minor].spinlock);
-out:
-	return rc;
+	return 0;
+out_nomem:
+	sbig_device_put(sd);
+	return -ENOMEM;
 }
 
 static int sbig_release(struct inode *inode, struct file *file)
@@ -76,6 +116,11 @@ static int sbig_release(struct inode *inode, struct file *file)
 	struct sbig_client *pd = file->private_data;
 
 	if (pd) {
+		sbig_sched_release_micro(pd);
+		sbig_device_put(pd->sd);
+		vfree(pd->accum);
+		sbig_tdi_release(pd);
+		sbig_guide_release(pd);
 		kfree(pd->buffer);
 		kfree(pd);
 		file->private_data = NULL;
@@ -87,49 +132,85 @@ static long sbig_unlocked_ioctl(struct file *file,
 				unsigned int cmd, unsigned long arg)
 {
 	struct sbig_client *pd = file->private_data;
-	int minor = iminor(file_inode(file));
 
-	return sbig_ioctl(pd, cmd, arg, &sbig_table[minor].spinlock);
+	return sbig_ioctl(pd, cmd, arg);
 }
 
 static void sbig_attach(struct parport *port)
 {
 	struct pardev_cb ppdev_cb;
-	int nr = 0 + sbig_count;
+	struct sbig_device *sd;
+	int nr;
 
 	if (!(port->modes & PARPORT_MODE_PCSPP)) {
 		pr_info("%s: ignoring %s - no SPP capability\n",
 			__func__, port->name);
 		return;
 	}
-	if (nr == SBIG_NO) {
-		pr_info("%s: ignoring %s - max %d reached\n",
-			__func__, port->name, SBIG_NO);
+	sd = kzalloc(sizeof(*sd), GFP_KERNEL);
+	if (!sd)
 		return;
+	kref_init(&sd->kref);
+	mutex_init(&sd->lock);
+	spin_lock_init(&sd->spinlock);
+	spin_lock_init(&sd->jitter.lock);
+	spin_lock_init(&sd->rec.lock);
+	spin_lock_init(&sd->model.lock);
+	spin_lock_init(&sd->timing_lock);
+	sbig_timing_init(sd);
+	sbig_idle_init(sd);
+	sbig_tdi_init(sd);
+	sbig_guide_init(sd);
+	sbig_micro_init(sd);
+	sbig_sched_init(sd);
+	sd->port = port;
+
+	mutex_lock(&sbig_idr_lock);
+	nr = idr_alloc(&sbig_idr, NULL, 0, SBIG_MINORS, GFP_KERNEL);
+	mutex_unlock(&sbig_idr_lock);
+	if (nr < 0) {
+		pr_info("%s: ignoring %s - max %d reached\n",
+			__func__, port->name, SBIG_MINORS);
+		goto out_free;
 	}
+	sd->minor = nr;
+
 	memset(&ppdev_cb, 0, sizeof(ppdev_cb));
-	ppdev_cb.private = &sbig_table[nr];
-	sbig_table[nr].pardev = parport_register_dev_model(port, "sbiglpt",
-							   &ppdev_cb, nr);
-	if (sbig_table[nr].pardev == NULL) {
+	ppdev_cb.private = sd;
+	sd->pardev = parport_register_dev_model(port, "sbiglpt",
+						&ppdev_cb, nr);
+	if (sd->pardev == NULL) {
 		pr_err("%s: parport_register_device failed\n", __func__);
-		return;
+		goto out_idr;
 	}
-	if (parport_claim(sbig_table[nr].pardev)) {
+	if (parport_claim(sd->pardev)) {
 		pr_err("%s: parport_claim failed\n", __func__);
 		goto out;
 	}
-	sbig_table[nr].dev = device_create(sbig_class, port->dev,
-					   MKDEV(MAJOR(sbig_dev), nr),
-					   NULL, "sbiglpt%d", nr);
-	if (IS_ERR(sbig_table[nr].dev)) {
+	sbig_calibrate_io(sd);
+	sbig_worker_start(sd);
+	sd->dev = device_create_with_groups(sbig_class, port->dev,
+					    MKDEV(MAJOR(sbig_dev), nr),
+					    sd, sbig_groups,
+					    "sbiglpt%d", nr);
+	if (IS_ERR(sd->dev)) {
 		pr_err("%s: device_create failed\n", __func__);
 		goto out_release;
 	}
-	spin_lock_init(&sbig_table[nr].spinlock);
-	sbig_count++;
-	if (sbig_table[nr].dev) {
-		dev_info(sbig_table[nr].dev, "attached to %s\n", port->name);
+	get_device(sd->dev); // dropped when the last client lets go
+	sbig_stats_add(sd);
+	sbig_jitter_add(sd);
+	sbig_rec_add(sd);
+	sbig_status_alloc(sd);
+
+	// publish - the device may be opened from here on
+	mutex_lock(&sbig_idr_lock);
+	idr_replace(&sbig_idr, sd, nr);
+	mutex_unlock(&sbig_idr_lock);
+
+	if (sd->dev) {
+		dev_info(sd->dev, "attached to %s (read %u ns)\n",
+			 port->name, sd->io_read_ns);
 	} else {
 		pr_info("sbiglpt%d: attached to %s\n", nr, port->name);
 		pr_info("sbiglpt%d: hint: mknod /dev/sbiglpt%d c %d %d\n",
@@ -137,13 +218,46 @@ static void sbig_attach(struct parport *port)
 	}
 	return;
 out_release:
-	parport_release(sbig_table[nr].pardev);
+	sbig_worker_stop(sd);
+	parport_release(sd->pardev);
 out:
-	parport_unregister_device(sbig_table[nr].pardev);
+	parport_unregister_device(sd->pardev);
+out_idr:
+	mutex_lock(&sbig_idr_lock);
+	idr_remove(&sbig_idr, nr);
+	mutex_unlock(&sbig_idr_lock);
+out_free:
+	mutex_destroy(&sd->lock);
+	kfree(sd);
 }
 
 static void sbig_detach(struct parport *port)
 {
+	struct sbig_device *sd;
+	int nr;
+
+	mutex_lock(&sbig_idr_lock);
+	idr_for_each_entry(&sbig_idr, sd, nr) {
+		if (sd->port == port)
+			break;
+	}
+	if (sd)
+		idr_remove(&sbig_idr, nr);
+	mutex_unlock(&sbig_idr_lock);
+	if (!sd)
+		return;
+
+	// refuse new port commands and wait out the one in progress
+	mutex_lock(&sd->lock);
+	sbig_sched_shutdown(sd);
+	mutex_unlock(&sd->lock);
+
+	sbig_stats_remove(sd);
+	device_destroy(sbig_class, MKDEV(MAJOR(sbig_dev), sd->minor));
+	sbig_worker_stop(sd);
+	parport_release(sd->pardev);
+	parport_unregister_device(sd->pardev);
+	sbig_device_put(sd);
 }
 
 static struct parport_driver sbig_driver = {
@@ -153,16 +267,47 @@ static struct parport_driver sbig_driver = {
 	.devmodel = true,
 };
 
+static int sbig_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct sbig_client *pd = file->private_data;
+
+	return sbig_status_mmap(pd->sd, vma);
+}
+
+// rows of IOCTL_TDI_SCAN or records of IOCTL_GUIDE_STREAM
+static ssize_t sbig_read(struct file *file, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	struct sbig_client *pd = file->private_data;
+	bool nonblock = file->f_flags & O_NONBLOCK;
+
+	if (READ_ONCE(pd->stream) == SBIG_STREAM_GUIDE)
+		return sbig_guide_read(pd, buf, count, nonblock);
+	return sbig_tdi_read(pd, buf, count, nonblock);
+}
+
+static sbig_poll_t sbig_poll(struct file *file, poll_table *wait)
+{
+	struct sbig_client *pd = file->private_data;
+
+	if (READ_ONCE(pd->stream) == SBIG_STREAM_GUIDE)
+		return sbig_guide_poll(pd, file, wait);
+	return sbig_tdi_poll(pd, file, wait);
+}
+
 static const struct file_operations sbig_fops = {
 	.owner = THIS_MODULE,
 	.open = sbig_open,
 	.release = sbig_release,
+	.read = sbig_read,
+	.poll = sbig_poll,
 	.unlocked_ioctl = sbig_unlocked_ioctl,
+	.mmap = sbig_mmap,
 };
 
 static int sbig_init_module(void)
 {
-	if (alloc_chrdev_region(&sbig_dev, 0, SBIG_NO, "sbiglpt") < 0) {
+	if (alloc_chrdev_region(&sbig_dev, 0, SBIG_MINORS, "sbiglpt") < 0) {
 		pr_err("%s: alloc_chrdev_region failed\n", __func__);
 		goto out;
 	}
@@ -172,38 +317,35 @@ static int sbig_init_module(void)
 		goto out_reg;
 	}
 	cdev_init(&sbig_cdev, &sbig_fops);
-	if (cdev_add(&sbig_cdev, sbig_dev, SBIG_NO) < 0) {
+	if (cdev_add(&sbig_cdev, sbig_dev, SBIG_MINORS) < 0) {
 		pr_err("%s: cdev_add failed\n", __func__);
 		goto out_class;
 	}
+	sbig_stats_init();
 	if (parport_register_driver(&sbig_driver)) {
 		pr_err("%s: parport_register_driver failed\n", __func__);
 		goto out_cdev;
 	}
 	return (0);
 out_cdev:
+	sbig_stats_exit();
 	cdev_del(&sbig_cdev);
 out_class:
 	class_destroy(sbig_class);
 out_reg:
-	unregister_chrdev_region(sbig_dev, SBIG_NO);
+	unregister_chrdev_region(sbig_dev, SBIG_MINORS);
 out:
 	return (-1);
 }
 
 static void sbig_cleanup_module(void)
 {
-	int nr;
-
-	parport_unregister_driver(&sbig_driver);
+	parport_unregister_driver(&sbig_driver); // detaches all ports
+	sbig_stats_exit();
 	cdev_del(&sbig_cdev);
-	for (nr = 0; nr < sbig_count; nr++) {
-		parport_release(sbig_table[nr].pardev);
-		parport_unregister_device(sbig_table[nr].pardev);
-		device_destroy(sbig_class, MKDEV(MAJOR(sbig_dev), nr));
-	}
 	class_destroy(sbig_class);
-	unregister_chrdev_region(sbig_dev, SBIG_NO);
+	unregister_chrdev_region(sbig_dev, SBIG_MINORS);
+	idr_destroy(&sbig_idr);
 }
 
 module_init(sbig_init_module);
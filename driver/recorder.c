@@ -0,0 +1,352 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver flight recorder
+ *
+ * When armed, every sbig_outb() and sbig_inb() is recorded in a ring
+ * with its time, data, what it was for and the command it was part of.
+ * The ring freezes by itself when a command fails with a camera error
+ * (timeouts, NAK, CAN, unknown response, bad length), or when two port
+ * accesses in a command are further apart than recorder_anomaly_ns.
+ * Sleeps in waits and row boundaries don't count as anomalies.
+ *
+ *	echo armed > /sys/class/sbiglpt/sbiglptN/recorder
+ *	... reproduce ...
+ *	cat /sys/class/sbiglpt/sbiglptN/recorder
+ *	cat /sys/kernel/debug/sbiglpt/sbiglptN/recorder > trace.txt
+ *
+ * The debugfs file is empty while armed.  Lines starting with # describe
+ * the capture, then one line per access, oldest first:
+ *	ns w|r data op cmd
+ * tools/sbig-replay replays a capture against a mock port.
+ *
+ * The ring is allocated when first armed, recorder_entries long, and
+ * kept until the device goes away.  Recording takes a spinlock and a
+ * clock read per access, so timing is a little slower while armed.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/overflow.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "sbiglpt.h"
+#include "sbiglpt_module.h"
+
+static unsigned int recorder_entries = 65536;
+module_param(recorder_entries, uint, 0644);
+MODULE_PARM_DESC(recorder_entries,
+		 "Port accesses kept by the flight recorder (power of 2)");
+
+#define SBIG_REC_MAX_ENTRIES	(1U << 22)
+
+static const char * const sbig_rec_state_names[SBIG_REC_COUNT] = {
+	[SBIG_REC_OFF] = "off",
+	[SBIG_REC_ARMED] = "armed",
+	[SBIG_REC_FROZEN] = "frozen",
+};
+
+static const char * const sbig_rec_op_names[SBIG_OP_COUNT] = {
+	[SBIG_OP_OTHER] = "other",
+	[SBIG_OP_DIGITIZE] = "digitize",
+	[SBIG_OP_CLEAR] = "clear",
+	[SBIG_OP_VCLOCK] = "vclock",
+	[SBIG_OP_MICRO] = "micro",
+};
+
+// Call with r->lock held.
+static void sbig_rec_freeze_locked(struct sbig_recorder *r, int status,
+				   u64 gap_ns)
+{
+	r->state = SBIG_REC_FROZEN;
+	r->status = status;
+	r->gap_ns = gap_ns;
+	r->frozen_cmd = r->cmd;
+}
+
+void sbig_rec_port(struct sbig_device *sd, bool write, u8 data)
+{
+	struct sbig_recorder *r = &sd->rec;
+	struct sbig_rec_entry *e;
+	u64 now = local_clock();
+	unsigned int anomaly_ns = READ_ONCE(r->anomaly_ns);
+
+	spin_lock(&r->lock);
+	if (r->state != SBIG_REC_ARMED) {
+		spin_unlock(&r->lock);
+		return;
+	}
+	e = &r->ring[r->head++ & (r->size - 1)];
+	e->ns = now;
+	e->write = write;
+	e->data = data;
+	e->op = sd->port_op;
+	e->cmd = r->cmd;
+	if (anomaly_ns && r->last_ns && now - r->last_ns > anomaly_ns)
+		sbig_rec_freeze_locked(r, CE_NO_ERROR, now - r->last_ns);
+	r->last_ns = now;
+	spin_unlock(&r->lock);
+}
+
+// Note the command now using the port.  Returns the previous one.
+u8 sbig_rec_command(struct sbig_device *sd, u8 nr)
+{
+	u8 old = sd->rec.cmd;
+
+	sd->rec.cmd = nr;
+	sbig_rec_pause(sd);
+	return old;
+}
+
+// Freeze on camera errors.  Parameter errors and -errno are not logged.
+void sbig_rec_status(struct sbig_device *sd, int status)
+{
+	struct sbig_recorder *r = &sd->rec;
+
+	if (status <= 0 || status == CE_BAD_PARAMETER)
+		return;
+	spin_lock(&r->lock);
+	if (r->state == SBIG_REC_ARMED)
+		sbig_rec_freeze_locked(r, status, 0);
+	spin_unlock(&r->lock);
+}
+
+// Start recording afresh, allocating the ring the first time.
+static int sbig_rec_arm(struct sbig_device *sd)
+{
+	struct sbig_recorder *r = &sd->rec;
+	struct sbig_rec_entry *ring = NULL;
+	unsigned int size;
+
+	if (!r->ring) {
+		size = clamp(READ_ONCE(recorder_entries), 1U,
+			     SBIG_REC_MAX_ENTRIES);
+		size = roundup_pow_of_two(size);
+		ring = vzalloc(array_size(size, sizeof(*ring)));
+		if (!ring)
+			return -ENOMEM;
+	}
+	spin_lock(&r->lock);
+	if (ring && !r->ring) {
+		r->ring = ring;
+		r->size = size;
+		ring = NULL;
+	}
+	r->head = 0;
+	r->last_ns = 0;
+	r->status = CE_NO_ERROR;
+	r->gap_ns = 0;
+	r->state = SBIG_REC_ARMED;
+	spin_unlock(&r->lock);
+	vfree(ring); // lost a race with another arm
+	return 0;
+}
+
+void sbig_rec_free(struct sbig_device *sd)
+{
+	vfree(sd->rec.ring);
+}
+
+// what the debugfs file shows, copied when it is opened
+struct sbig_rec_snap {
+	enum sbig_rec_state state;
+	int status;
+	u64 gap_ns;
+	u8 cmd;
+	unsigned int count;
+	unsigned int lost;
+	struct sbig_rec_entry e[];
+};
+
+static void *sbig_rec_start(struct seq_file *m, loff_t *pos)
+{
+	struct sbig_rec_snap *snap = m->private;
+
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	return *pos <= snap->count ? &snap->e[*pos - 1] : NULL;
+}
+
+static void *sbig_rec_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return sbig_rec_start(m, pos);
+}
+
+static void sbig_rec_stop(struct seq_file *m, void *v)
+{
+}
+
+static int sbig_rec_show(struct seq_file *m, void *v)
+{
+	struct sbig_rec_snap *snap = m->private;
+	struct sbig_rec_entry *e = v;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(m, "# state %s status %d gap_ns %llu cmd %u\n",
+			   sbig_rec_state_names[snap->state], snap->status,
+			   snap->gap_ns, snap->cmd);
+		seq_printf(m, "# entries %u lost %u\n", snap->count,
+			   snap->lost);
+		return 0;
+	}
+	seq_printf(m, "%llu %c 0x%02x %s %u\n", e->ns, e->write ? 'w' : 'r',
+		   e->data, e->op < SBIG_OP_COUNT ?
+		   sbig_rec_op_names[e->op] : "?", e->cmd);
+	return 0;
+}
+
+static const struct seq_operations sbig_rec_seq_ops = {
+	.start = sbig_rec_start,
+	.next = sbig_rec_next,
+	.stop = sbig_rec_stop,
+	.show = sbig_rec_show,
+};
+
+static int sbig_rec_open(struct inode *inode, struct file *file)
+{
+	struct sbig_device *sd = inode->i_private;
+	struct sbig_recorder *r = &sd->rec;
+	struct sbig_rec_snap *snap;
+	unsigned int size = READ_ONCE(r->size);
+	unsigned int first, i;
+	int rc;
+
+	snap = vzalloc(struct_size(snap, e, size));
+	if (!snap)
+		return -ENOMEM;
+	spin_lock(&r->lock);
+	snap->state = r->state;
+	snap->status = r->status;
+	snap->gap_ns = r->gap_ns;
+	snap->cmd = r->frozen_cmd;
+	if (r->state != SBIG_REC_ARMED && r->ring) {
+		snap->count = min(r->head, size);
+		snap->lost = r->head - snap->count;
+		first = r->head - snap->count;
+		for (i = 0; i < snap->count; i++)
+			snap->e[i] = r->ring[(first + i) & (r->size - 1)];
+	}
+	spin_unlock(&r->lock);
+
+	rc = seq_open(file, &sbig_rec_seq_ops);
+	if (rc < 0) {
+		vfree(snap);
+		return rc;
+	}
+	((struct seq_file *)file->private_data)->private = snap;
+	return 0;
+}
+
+static int sbig_rec_release(struct inode *inode, struct file *file)
+{
+	vfree(((struct seq_file *)file->private_data)->private);
+	return seq_release(inode, file);
+}
+
+static const struct file_operations sbig_rec_fops = {
+	.owner = THIS_MODULE,
+	.open = sbig_rec_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = sbig_rec_release,
+};
+
+void sbig_rec_add(struct sbig_device *sd)
+{
+	if (sd->debugfs)
+		debugfs_create_file("recorder", 0400, sd->debugfs, sd,
+				    &sbig_rec_fops);
+}
+
+static ssize_t recorder_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_recorder *r = &sd->rec;
+	enum sbig_rec_state state;
+	unsigned int head;
+	int status;
+	u64 gap_ns;
+
+	spin_lock(&r->lock);
+	state = r->state;
+	head = r->head;
+	status = r->status;
+	gap_ns = r->gap_ns;
+	spin_unlock(&r->lock);
+	return scnprintf(buf, PAGE_SIZE,
+			 "%s accesses %u status %d gap_ns %llu\n",
+			 sbig_rec_state_names[state], head, status, gap_ns);
+}
+
+static ssize_t recorder_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_recorder *r = &sd->rec;
+	int i, rc = 0;
+
+	i = sysfs_match_string(sbig_rec_state_names, buf);
+	if (i < 0)
+		return i;
+	switch (i) {
+	case SBIG_REC_ARMED:
+		rc = sbig_rec_arm(sd);
+		break;
+	case SBIG_REC_FROZEN:
+		spin_lock(&r->lock);
+		if (r->state == SBIG_REC_ARMED)
+			sbig_rec_freeze_locked(r, CE_NO_ERROR, 0);
+		spin_unlock(&r->lock);
+		break;
+	default:
+		spin_lock(&r->lock);
+		r->state = SBIG_REC_OFF;
+		spin_unlock(&r->lock);
+		break;
+	}
+	return rc < 0 ? rc : count;
+}
+static DEVICE_ATTR_RW(recorder);
+
+static ssize_t recorder_anomaly_ns_show(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 READ_ONCE(sd->rec.anomaly_ns));
+}
+
+static ssize_t recorder_anomaly_ns_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	unsigned int val;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &val);
+	if (rc < 0)
+		return rc;
+	WRITE_ONCE(sd->rec.anomaly_ns, val);
+	return count;
+}
+static DEVICE_ATTR_RW(recorder_anomaly_ns);
+
+static struct attribute *sbig_recorder_attrs[] = {
+	&dev_attr_recorder.attr,
+	&dev_attr_recorder_anomaly_ns.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_recorder_group = {
+	.attrs = sbig_recorder_attrs,
+};
@@ -42,6 +42,33 @@
 #define IOCTL_GET_BUFFER_SIZE		_IO(IOCTL_BASE, 32)
 #define IOCTL_TEST_COMMAND		_IO(IOCTL_BASE, 33)
 
+/* Extensions, not used by the SBIG SDK.  IOCTL_CANCEL abandons the port
+ * command in progress on the same open file at its next row.
+ */
+#define IOCTL_CANCEL			_IO(IOCTL_BASE, 40)
+#define IOCTL_GET_PROGRESS		_IOR(IOCTL_BASE, 41, \
+					     struct sbig_progress)
+#define IOCTL_PREDICT_AREA		_IOWR(IOCTL_BASE, 42, \
+					      struct sbig_predict)
+#define IOCTL_AUTOTUNE			_IOWR(IOCTL_BASE, 43, \
+					      struct sbig_autotune)
+#define IOCTL_GET_AREA_STATS		_IOWR(IOCTL_BASE, 44, \
+					      struct sbig_area_stats)
+#define IOCTL_GET_PREVIEW		_IOW(IOCTL_BASE, 45, \
+					     struct sbig_preview)
+#define IOCTL_GET_ROIS			_IOW(IOCTL_BASE, 46, \
+					     struct sbig_rois)
+#define IOCTL_ACCUMULATE		_IOWR(IOCTL_BASE, 47, \
+					      struct sbig_accumulate)
+#define IOCTL_IDLE_CLEAR		_IOW(IOCTL_BASE, 48, \
+					     struct sbig_idle_clear)
+#define IOCTL_TDI_SCAN			_IOW(IOCTL_BASE, 49, \
+					     struct sbig_tdi_scan)
+#define IOCTL_GUIDE_STREAM		_IOW(IOCTL_BASE, 50, \
+					     struct sbig_guide_stream)
+#define IOCTL_TIMED_MICRO_BLOCK		_IOWR(IOCTL_BASE, 51, \
+					      struct sbig_timed_micro)
+
 struct ioc_get_pixels_params {
 	__s16 /* CAMERA_TYPE */ cameraID;
 	__s16 /* CCD_REQUEST */ ccd;
@@ -116,6 +143,245 @@ struct linux_get_area_params {
 	unsigned long length; // N.B. change to fixed size breaks ABI
 };
 
+/* Rows done by the port command in progress.  cmd is its _IOC_NR(),
+ * or 0 if the port is idle or the command doesn't work in rows.
+ */
+struct sbig_progress {
+	__u32 cmd;
+	__u32 row;
+	__u32 total;
+};
+
+/* How long IOCTL_GET_AREA with gap would keep the port, from costs
+ * measured on earlier readouts, not counting commands of other clients
+ * let in between rows.  ns is 0 until a row of that CCD has been read.
+ */
+struct sbig_predict {
+	struct ioc_get_area_params gap;
+	__u64 ns;
+};
+
+/* Find the shortest vertical clock delay that reads the same bias frame
+ * as the default timing, and make it the tuned timing profile.  The
+ * shutter must be closed.  gap is the frame read from the imaging CCD,
+ * each time after clearing clear_height rows, and the buffer set with
+ * IOCTL_SET_BUFFER_SIZE must hold it whole.  The rest is filled in;
+ * means and standard deviations are in 1/100 ADU.
+ */
+struct sbig_autotune {
+	struct ioc_get_area_params gap;
+	__u32 clear_height;
+	__u32 vclock_delay_ns;
+	__u32 steps;		// delays tried
+	__u32 ref_mean;		// at the default delay
+	__u32 ref_sd;
+	__u32 mean;		// at vclock_delay_ns
+	__u32 sd;
+};
+
+/* Read gap like IOCTL_GET_AREA, but return statistics of its pixels
+ * instead of the pixels, for auto-exposure, focus and sky brightness
+ * loops.  The buffer only needs to hold a row.
+ *
+ * Pixel value v counts in bin min(v >> hist_shift, SBIG_STATS_BINS - 1).
+ * Each percentile[i] is interpolated in its bin for permille[i] of the
+ * pixels, so it is exact only when hist_shift is 0 and the pixels are
+ * below SBIG_STATS_BINS.  Means and standard deviations are in 1/100
+ * ADU.  If profile isn't NULL, the mean of each row is stored there.
+ */
+#define SBIG_STATS_BINS		256
+#define SBIG_STATS_PERCENTILES	4
+
+struct sbig_area_stats {
+	struct ioc_get_area_params gap;
+	__u32 hist_shift;	// 0 to 16
+	__u32 *profile;		// gap.height row means
+	__u16 permille[SBIG_STATS_PERCENTILES];
+	__u16 percentile[SBIG_STATS_PERCENTILES];
+	__u64 pixels;
+	__u32 mean;
+	__u32 sd;
+	__u16 min;
+	__u16 max;
+	__u32 hist[SBIG_STATS_BINS];
+};
+
+/* Read gap like IOCTL_GET_AREA for framing and focusing, but only every
+ * row_step-th row and every col_step-th pixel of it, into dest.  The
+ * rows between are dumped, which is much faster than digitizing them.
+ * Pixels are all digitized, as the A/D runs a pixel ahead, and the
+ * rest dropped before copying; use gap.horzBin for faster rows.  length
+ * is DIV_ROUND_UP(height, row_step) * DIV_ROUND_UP(len, col_step) * 2.
+ */
+struct sbig_preview {
+	struct ioc_get_area_params gap;
+	__u16 row_step;
+	__u16 col_step;
+	__u16 *dest;
+	__u32 length;
+};
+
+/* Read up to SBIG_ROIS_MAX regions of an exposure in one pass, which
+ * separate IOCTL_DUMP_ILINES and IOCTL_GET_AREA calls can't do when the
+ * regions share rows.  In gap, len is the width of the rows and height
+ * how many there are, in binned pixels; left and right are not used.
+ * Regions are relative to the first row, may overlap, and are stored at
+ * dest one after the other, each row by row.  length is the sum of
+ * their height * len * 2, and the buffer must also hold a row.
+ *
+ * Rows on no region are dumped and the rest digitized from the leftmost
+ * to the rightmost region on them.  Rows below the last region are left
+ * in the CCD.
+ */
+#define SBIG_ROIS_MAX		16
+
+struct sbig_roi {
+	__u16 top;
+	__u16 left;
+	__u16 height;
+	__u16 len;
+};
+
+struct sbig_rois {
+	struct ioc_get_area_params gap;
+	__u32 count;
+	struct sbig_roi roi[SBIG_ROIS_MAX];
+	__u16 *dest;
+	__u32 length;
+};
+
+/* Sum frames in the driver, for stacking many short exposures.  After
+ * SBIG_ACCUM_START with gap, each IOCTL_GET_AREA of the client with
+ * exactly that gap adds the frame to 32-bit sums instead of copying it
+ * out, and needs a buffer of only a row.  SBIG_ACCUM_FETCH copies the
+ * gap.height * gap.len sums to dest, length bytes, sets frames to how
+ * many were summed and starts over.  Up to SBIG_ACCUM_MAX_FRAMES are
+ * summed, so the sums can't overflow.  SBIG_ACCUM_STOP frees the sums,
+ * as does closing the device.
+ */
+#define SBIG_ACCUM_START	1
+#define SBIG_ACCUM_FETCH	2
+#define SBIG_ACCUM_STOP		3
+#define SBIG_ACCUM_MAX_FRAMES	65537
+
+struct sbig_accumulate {
+	struct ioc_get_area_params gap;
+	__u32 op;
+	__u32 *dest;
+	__u32 length;
+	__u32 frames;
+};
+
+/* Keep clearing ccd a row at a time while the port is idle, or stop if
+ * on is 0.  The next IOCTL_CLEAR_IMAG_CCD or IOCTL_CLEAR_TRAC_CCD of it
+ * stops it too, and takes only a row if the rows asked for were cleared
+ * already.  Ask again after each exposure is read out.
+ */
+struct sbig_idle_clear {
+	__s16 /* CAMERA_TYPE */ cameraID;
+	__s16 /* CCD_REQUEST */ ccd;
+	__u32 on;
+};
+
+/* Drift scan the imaging CCD.  Every period_ns from the start it is
+ * shifted gap.vertBin lines and a row of gap.len pixels is digitized,
+ * gap.height rows in all, or until IOCTL_CANCEL if 0.  Rows are queued
+ * in a ring of ring_rows for read() from another thread while the ioctl
+ * runs, which returns whole rows only, and 0 once the scan has ended and
+ * the ring is empty.  Rows are dropped while the ring is full.
+ */
+struct sbig_tdi_scan {
+	struct ioc_get_area_params gap;
+	__u32 ring_rows;
+	__u64 period_ns;
+};
+
+/* Guide from a region of the tracking CCD.  Each cycle clears
+ * ccd_height rows, lets the CCD integrate for exposure_us, dumps top rows
+ * and reads the region described by gap (gap.ccd must be CCD_TRACKING).
+ * A struct sbig_guide_record is then queued for read() from another
+ * thread, followed by the region's pixels if flags has SBIG_GUIDE_RAW.
+ * Cycles start every period_us, or back to back if 0, count of them or
+ * until IOCTL_CANCEL if 0.  queue is how many records are kept; records
+ * are dropped while the queue is full.
+ */
+#define SBIG_GUIDE_RAW		0x1
+#define SBIG_GUIDE_MAX_PIXELS	(1 << 20)
+
+struct sbig_guide_stream {
+	struct ioc_get_area_params gap;
+	__u16 top;
+	__u16 ccd_height;
+	__u32 exposure_us;
+	__u32 period_us;
+	__u32 count;
+	__u32 flags;
+	__u32 queue;
+};
+
+/* The centroid is of the pixels above the background, the mean of the
+ * region's edge, in 1/256 pixel from the top left pixel of the region,
+ * or -1 if none are.  Times are CLOCK_MONOTONIC.  dropped counts the
+ * records lost to a full queue since the last one.
+ */
+struct sbig_guide_record {
+	__u64 seq;
+	__u64 start_ns;		// integration began
+	__u64 end_ns;		// and ended
+	__u64 flux;		// sum above the background
+	__s32 x;
+	__s32 y;
+	__u16 peak;
+	__u16 background;
+	__s32 status;		// of the readout, enum par_error
+	__u32 dropped;
+	__u32 reserved;
+};
+
+/* Send a micro block of length bytes at deadline_ns on clock, which is
+ * CLOCK_MONOTONIC or CLOCK_REALTIME, e.g. to start or end an exposure on
+ * time.  The reply is fetched with IOCTL_GET_MICRO_BLOCK as usual.  On
+ * return start_ns and end_ns are when the handshake started and the last
+ * nibble went out, on clock, and error_ns is start_ns - deadline_ns.  A
+ * deadline in the past sends at once.
+ */
+struct sbig_timed_micro {
+	__u8 *data;
+	__u32 length;
+	__s32 clock;
+	__u64 deadline_ns;
+	__u64 start_ns;
+	__u64 end_ns;
+	__s64 error_ns;
+};
+
+/* Read-only page mmap()ed at offset 0 of the device, to watch it
+ * without ioctls.  seq is odd while the driver updates the page:
+ *
+ *	do {
+ *		seq = READ_ONCE(st->seq);
+ *		rmb();
+ *		copy = *st;
+ *		rmb();
+ *	} while ((seq & 1) || seq != READ_ONCE(st->seq));
+ *
+ * cmd, row and total are as in struct sbig_progress.  last_error is the
+ * last camera error of any client.  The counts add up all readouts.
+ */
+struct sbig_status {
+	__u32 seq;
+	__u32 size;		// sizeof(struct sbig_status)
+	__u32 cmd;
+	__u32 row;
+	__u32 total;
+	__u32 last_error;
+	__u64 frames;		// area readouts completed
+	__u64 rows;		// rows digitized
+	__u64 pixels;
+	__u64 bytes;		// pixel data copied to user space
+	__u64 update_ns;	// CLOCK_MONOTONIC
+};
+
 /* values must match PAR_ERROR in sbigudrv.h */
 enum par_error {
 	CE_NO_ERROR = 0,
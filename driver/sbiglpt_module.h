@@ -7,29 +7,545 @@
 #ifndef _SBIGLPT_MODULE_H
 #define _SBIGLPT_MODULE_H
 
+#include <linux/atomic.h>
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
 #include <linux/parport.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/sched/clock.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+
+#include "sbiglpt.h"
 
 #define DRIVER_VERSION_BCD	0x0435
 #define DRIVER_VERSION_STRING	"4.35"
 
-struct sbig_client {
+#define SBIG_MINORS		64
+
+/* Port users are classed by how long they can afford to wait.
+ * Classes are listed in priority order.
+ */
+enum sbig_class {
+	SBIG_CLASS_GUIDE,	// micro commands, tracking CCD reads
+	SBIG_CLASS_IMAGING,	// everything else
+	SBIG_CLASS_COUNT,
+};
+
+struct sbig_sched_stats {
+	u64 count;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+struct sbig_sched {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	bool busy;
+	struct sbig_client *owner;	// of the port while busy
+	bool dead;	// device detached
+	bool yielding;	// port lent out by a readout of yield_cls
+	enum sbig_class yield_cls;
+	int waiting[SBIG_CLASS_COUNT];
+	struct sbig_client *micro_owner;	// reply pending for this client
+	unsigned long micro_expires;
+	struct sbig_sched_stats stats[SBIG_CLASS_COUNT];
+};
+
+/* What KDisable() protects during a readout.  The tighter the policy,
+ * the less clock timing jitter, and the longer everything else waits.
+ */
+enum sbig_readout_policy {
+	SBIG_POLICY_PREEMPT,	// nothing, reschedule between rows
+	SBIG_POLICY_ROW,	// no preemption for a whole row
+	SBIG_POLICY_IRQ,	// no interrupts during CCD clock sequences
+	SBIG_POLICY_COUNT,
+};
+
+// row durations and atomic sections, see sched.c
+struct sbig_row_stats {
+	u64 rows;
+	u64 mean_ns;
+	u64 m2;			// sum of squared deviations (ns^2)
+	u64 min_ns;
+	u64 max_ns;
+	u64 atomic;		// sections with preemption or irqs off
+	u64 atomic_ns;
+	u64 atomic_max_ns;
+};
+
+// see wait.c
+struct sbig_wait {
+	u64 start;
+	u64 deadline;
+	unsigned int polls;
+	unsigned int sleep_us;
+	u64 slept_ns;
+	u64 last_sleep_ns;
+};
+
+struct sbig_wait_stats {
+	u64 waits;
+	u64 timeouts;
+	u64 sleeps;
+	u64 wait_ns;		// total time in waits that polled
+	u64 sleep_ns;		// part of wait_ns spent asleep
+	u64 late_ns;		// upper bound on latency added by sleeping
+	u64 delay_ns;		// fixed delays slept instead of spun
+};
+
+// A/D and PLD busy polling
+struct sbig_poll_stats {
+	u64 waits;
+	u64 polls;
+	u64 timeouts;
+	unsigned int max_polls;
+	unsigned int min_polls;
+};
+
+// readout thread, see worker.c
+struct sbig_worker {
+	struct task_struct *task;
+	spinlock_t lock;
+	struct list_head queue;		// struct sbig_work
+	wait_queue_head_t wait;
+	int cpu;			// -1 = any
+	unsigned int priority;		// SCHED_FIFO, 0 = SCHED_NORMAL
+};
+
+// debugfs counters, see stats.c
+enum sbig_busy {
+	SBIG_BUSY_MICRO,	// micro handshake spinning
+	SBIG_BUSY_PLD,
+	SBIG_BUSY_AD,
+	SBIG_BUSY_DELAY,	// clock delays
+	SBIG_BUSY_COUNT,
+};
+
+enum sbig_timeout {
+	SBIG_TIMEOUT_TX,
+	SBIG_TIMEOUT_RX,
+	SBIG_TIMEOUT_PLD,
+	SBIG_TIMEOUT_AD,
+	SBIG_TIMEOUT_COUNT,
+};
+
+// what the port is being used for, see stats.c
+enum sbig_op {
+	SBIG_OP_OTHER,
+	SBIG_OP_DIGITIZE,	// per pixel
+	SBIG_OP_CLEAR,		// per block cleared by the PLD
+	SBIG_OP_VCLOCK,		// per vertical clock
+	SBIG_OP_MICRO,		// per nibble
+	SBIG_OP_COUNT,
+};
+
+#define SBIG_STATS_NR		64	// ioctl _IOC_NR() values tracked
+#define SBIG_HIST_BUCKETS	28	// log2 usec, last is >= 2^26 usec
+
+struct sbig_stats {
+	u32 ioctl_hist[SBIG_STATS_NR][SBIG_HIST_BUCKETS];
+	u64 ioctl_ns[SBIG_STATS_NR];
+	u64 busy_count[SBIG_BUSY_COUNT];
+	u64 busy_ns[SBIG_BUSY_COUNT];
+	u64 timeouts[SBIG_TIMEOUT_COUNT];
+	u64 bytes_in;
+	u64 bytes_out;
+	u64 port_out[SBIG_OP_COUNT];
+	u64 port_in[SBIG_OP_COUNT];
+	u64 port_units[SBIG_OP_COUNT];
+};
+
+// A/D trigger intervals of a frame, see jitter.c
+#define SBIG_JITTER_BUCKETS	24	// log2 ns, last is >= 2^22 ns
+#define SBIG_JITTER_ROWS	64	// flagged rows kept
+
+struct sbig_jitter_row {
+	u32 row;
+	u32 max_ns;
+};
+
+struct sbig_jitter_frame {
+	u64 seq;
+	int status;
+	unsigned int threshold_ns;
+	u32 rows;
+	u32 max_row;
+	u64 max_ns;
+	u64 intervals;
+	u32 flagged;		// rows over threshold_ns
+	u32 hist[SBIG_JITTER_BUCKETS];
+	struct sbig_jitter_row row[SBIG_JITTER_ROWS];
+};
+
+struct sbig_jitter {
+	spinlock_t lock;		// last, seq
+	unsigned int threshold_ns;	// from sysfs, 0 = off
+	u64 seq;
+	struct sbig_jitter_frame last;
+};
+
+// port I/O flight recorder, see recorder.c
+enum sbig_rec_state {
+	SBIG_REC_OFF,
+	SBIG_REC_ARMED,
+	SBIG_REC_FROZEN,
+	SBIG_REC_COUNT,
+};
+
+struct sbig_rec_entry {
+	u64 ns;			// local_clock()
+	u8 write;		// else read
+	u8 data;
+	u8 op;			// enum sbig_op
+	u8 cmd;			// _IOC_NR() of the command
+};
+
+struct sbig_recorder {
+	spinlock_t lock;
+	enum sbig_rec_state state;
+	struct sbig_rec_entry *ring;	// allocated when first armed
+	unsigned int size;		// power of 2
+	unsigned int head;		// accesses recorded since armed
+	u64 last_ns;			// previous access, 0 after a pause
+	unsigned int anomaly_ns;	// from sysfs, 0 = no latency freeze
+	u8 cmd;				// command using the port
+	u8 frozen_cmd;
+	int status;			// camera error that froze it
+	u64 gap_ns;			// or the gap that did
+};
+
+// readout time model, see model.c
+#define SBIG_MODEL_CCDS		2	// imaging, tracking
+
+struct sbig_model_costs {
+	u64 rows;
+	u64 vclock;		// ns per line, fixed point
+	u64 clear;		// ns per PLD clear
+	u64 pixel;		// ns per pixel digitized
+};
+
+struct sbig_model {
+	spinlock_t lock;
+	struct sbig_model_costs ccd[SBIG_MODEL_CCDS];
+	u64 predictions;
+	s64 err_ns;		// sum of predicted - actual
+	u64 abs_err_ns;
+	u64 abs_err_permille;	// relative to actual
+	u64 max_abs_err_ns;
+};
+
+// CCD clock timing, see timing.c
+struct sbig_timing {
+	unsigned int vclock_delay_ns;
+	unsigned int st1k_vclock_x;
+	unsigned int dump_ratio;
+	unsigned int idle_state_ms;
+	unsigned int merge_clears;	// skip right clears, see KLptReadRow
+};
+
+// what merge_clears saved
+struct sbig_merged {
+	u64 frames;
+	u64 rows;
+	u64 blocks;		// PLD clears
+	u64 writes;		// port writes
+	u64 ns;			// estimated by the readout model
+};
+
+enum sbig_timing_profile {
+	SBIG_TIMING_DEFAULT,
+	SBIG_TIMING_TUNED,
+	SBIG_TIMING_CUSTOM,
+	SBIG_TIMING_COUNT,
+};
+
+// clearing while the port is idle, see idle.c
+#define SBIG_IDLE_CCDS		2
+#define SBIG_IDLE_BUSY_US	1000	// retry while the port is in use
+
+struct sbig_idle_stats {
+	u64 clears;
+	u64 swept;		// clears cut short
+	u64 total_ns;
+	u64 last_ns;
+	u64 max_ns;
+};
+
+struct sbig_idle {
+	spinlock_t lock;
+	struct sbig_client *pd;		// the readout thread's
+	bool armed[SBIG_IDLE_CCDS];
+	bool taken[SBIG_IDLE_CCDS];	// last clear was cut short
+	int cameraID[SBIG_IDLE_CCDS];
+	u64 swept[SBIG_IDLE_CCDS];	// rows cleared in a row
+	u64 rows;
+	unsigned int pause_us;
+	struct sbig_idle_stats stats[SBIG_IDLE_CCDS];
+};
+
+// ->poll() returned unsigned int before 4.16
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+#define sbig_poll_t		unsigned int
+#define EPOLLIN			POLLIN
+#define EPOLLRDNORM		POLLRDNORM
+#else
+#define sbig_poll_t		__poll_t
+#endif
+
+// drift scan, see tdi.c
+struct sbig_tdi_ring {
+	struct mutex read_lock;		// readers, rows
+	spinlock_t lock;		// head, tail, done
+	wait_queue_head_t wait;
+	u16 *rows;
+	u32 len;			// pixels in a row
+	u32 slots;
+	u64 head;			// rows written
+	u64 tail;			// rows read
+	bool done;			// the scan ended, read() returns 0
+};
+
+struct sbig_tdi_stats {
+	bool running;
+	u64 period_ns;
+	u64 rows;
+	u64 dropped;			// the ring was full
+	u64 late;			// rows a period or more late
+	u64 late_ns;			// sum
+	u64 late_last_ns;
+	u64 late_max_ns;
+};
+
+struct sbig_tdi {
+	spinlock_t lock;
+	struct sbig_tdi_stats st;	// the last scan
+};
+
+// guide stream, see guide.c
+struct sbig_guide_queue {
+	struct mutex read_lock;
+	spinlock_t lock;		// done, dropped
+	DECLARE_KFIFO_PTR(fifo, u8);	// records and their pixels
+	wait_queue_head_t wait;
+	u32 size;			// of a record and its pixels
+	u32 dropped;			// since the last record queued
+	bool done;			// the stream ended, read() returns 0
+};
+
+// a step of the guide stream on the port, see KLptGuideStream()
+struct sbig_guide_frame {
+	const struct sbig_guide_stream *gs;
+	u16 *pixels;			// NULL to clear and start integrating
+	u64 t_ns;			// when integration started or ended
+};
+
+struct sbig_guide_stats {
+	bool running;
+	u64 cycles;
+	u64 errors;
+	u64 dropped;
+	u64 late_ns;			// integration overran, port busy
+	u64 late_max_ns;
+	u64 latency_ns;			// end of integration to record queued
+	u64 latency_last_ns;
+	u64 latency_max_ns;
+};
+
+struct sbig_guide {
+	spinlock_t lock;
+	struct sbig_guide_stats st;	// the last stream
+};
+
+// micro blocks sent on time, see micro.c
+struct sbig_micro_frame {
+	const u8 *data;
+	u32 length;
+	clockid_t clock;
+	u64 deadline_ns;
+	u64 start_ns;
+	u64 end_ns;
+};
+
+struct sbig_micro_stats {
+	u64 count;
+	u64 late;			// by more than micro_spin_us
+	s64 last_error_ns;
+	u64 abs_error_ns;		// sum
+	s64 min_error_ns;
+	s64 max_error_ns;
+};
+
+struct sbig_micro {
+	spinlock_t lock;		// st
+	unsigned int lead_us;		// take the port this early
+	unsigned int spin_us;		// and spin this long at the end
+	struct sbig_micro_stats st;
+};
+
+// what read() returns
+enum sbig_stream {
+	SBIG_STREAM_TDI,
+	SBIG_STREAM_GUIDE,
+};
+
+/* One per attached port.  Freed when the port is detached and the last
+ * client has closed it.
+ */
+struct sbig_device {
+	struct kref kref;
+	struct mutex lock;	// device state, detach
+	int minor;
+	struct pardevice *pardev;
+	struct device *dev;
+	struct parport *port;
+	spinlock_t spinlock;
 	u8 control_out;
 	u8 imaging_clocks_out;
+	struct sbig_sched sched;
+	struct sbig_worker worker;
+	struct sbig_wait_stats wait_stats;
+	unsigned int io_read_ns;	// measured cost of sbig_inb()
+	bool io_delay_reads;		// delay with reads, not ndelay()
+	struct sbig_poll_stats ad_polls;
+	struct sbig_poll_stats pld_polls;
+	unsigned int ad_readout_min;	// fewest A/D polls this readout
+	unsigned int ad_settle_ns;	// wait before first A/D poll
+	bool ad_adaptive;		// learn ad_settle_ns
+	enum sbig_readout_policy readout_policy;	// from sysfs
+	enum sbig_readout_policy policy;	// for the command in progress
+	int atomic_depth;
+	unsigned long irq_flags;
+	u64 atomic_t0;
+	struct sbig_row_stats row_stats;
+	struct sbig_model model;
+	spinlock_t timing_lock;		// profiles
+	struct sbig_timing timing;
+	struct sbig_timing timing_tuned;
+	bool timing_has_tuned;
+	enum sbig_timing_profile timing_profile;
+	struct sbig_merged merged;	// under timing_lock
+	struct sbig_idle idle;
+	struct sbig_tdi tdi;
+	struct sbig_guide guide;
+	struct sbig_micro micro;
+	struct sbig_stats __percpu *stats;
+	enum sbig_op port_op;		// counts sbig_outb() and sbig_inb()
+	struct dentry *debugfs;
+	struct sbig_jitter jitter;
+	struct sbig_recorder rec;
+	u32 progress_cmd;		// see struct sbig_progress
+	u32 progress_row;
+	u32 progress_total;
+	struct page *status_page;	// see status.c
+	struct sbig_status *status;
+	spinlock_t status_lock;		// writers of the page
+};
+
+struct sbig_client {
+	struct sbig_device *sd;
 	u16 last_error;
 	u16 buffer_size;
 	char *buffer;
 	struct device *dev;
 	struct parport *port;
+	atomic_t cancel_seq;	// bumped by IOCTL_CANCEL on this client
+	int cancel_start;	// cancel_seq when the command started
+	bool killed;		// caller got a fatal signal
+	bool jitter_active;	// timing the frame in progress
+	struct sbig_jitter_frame jitter;
+	u32 *accum;		// sums of IOCTL_ACCUMULATE
+	struct ioc_get_area_params accum_gap;
+	u32 accum_frames;
+	struct sbig_tdi_ring tdi;	// rows of IOCTL_TDI_SCAN
+	struct sbig_guide_queue guide;	// records of IOCTL_GUIDE_STREAM
+	enum sbig_stream stream;	// the last started
 };
 
+
+static inline void sbig_stat_busy(struct sbig_device *sd, enum sbig_busy b,
+				  u64 ns)
+{
+	if (sd->stats) {
+		this_cpu_inc(sd->stats->busy_count[b]);
+		this_cpu_add(sd->stats->busy_ns[b], ns);
+	}
+}
+
+static inline void sbig_stat_timeout(struct sbig_device *sd,
+				     enum sbig_timeout t)
+{
+	if (sd->stats)
+		this_cpu_inc(sd->stats->timeouts[t]);
+}
+
+static inline void sbig_stat_bytes(struct sbig_device *sd, u64 in, u64 out)
+{
+	if (sd->stats) {
+		this_cpu_add(sd->stats->bytes_in, in);
+		this_cpu_add(sd->stats->bytes_out, out);
+	}
+}
+
+static inline void sbig_stat_units(struct sbig_device *sd, enum sbig_op op,
+				   u32 units)
+{
+	if (sd->stats)
+		this_cpu_add(sd->stats->port_units[op], units);
+}
+
+void sbig_rec_port(struct sbig_device *sd, bool write, u8 data);
+
+// Don't count the time until the next port access as an anomaly.
+static inline void sbig_rec_pause(struct sbig_device *sd)
+{
+	sd->rec.last_ns = 0;
+}
+
 static inline void sbig_outb(struct sbig_client *pd, u8 data)
 {
+	if (pd->sd->stats)
+		this_cpu_inc(pd->sd->stats->port_out[pd->sd->port_op]);
 	pd->port->ops->write_data(pd->port, data);
+	if (READ_ONCE(pd->sd->rec.state) == SBIG_REC_ARMED)
+		sbig_rec_port(pd->sd, true, data);
 }
 
 static inline u8 sbig_inb(struct sbig_client *pd)
 {
-	return pd->port->ops->read_status(pd->port);
+	u8 data;
+
+	if (pd->sd->stats)
+		this_cpu_inc(pd->sd->stats->port_in[pd->sd->port_op]);
+	data = pd->port->ops->read_status(pd->port);
+	if (READ_ONCE(pd->sd->rec.state) == SBIG_REC_ARMED)
+		sbig_rec_port(pd->sd, false, data);
+	return data;
+}
+
+/* Time an A/D trigger.  *t is the previous one in this row, 0 for the
+ * first, and *max_ns the row's longest interval so far.
+ */
+static inline void sbig_jitter_pixel(struct sbig_client *pd, u64 *t,
+				     u64 *max_ns)
+{
+	struct sbig_jitter_frame *f = &pd->jitter;
+	u64 now = ktime_get_ns();
+	u64 ns = now - *t;
+
+	if (*t) {
+		f->intervals++;
+		f->hist[ns ? min(ilog2(ns) + 1, SBIG_JITTER_BUCKETS - 1) : 0]++;
+		if (*max_ns < ns)
+			*max_ns = ns;
+	}
+	*t = now;
 }
 
 #define sbig_dbg(pd, fmt, arg...) do { \
@@ -53,7 +569,136 @@ static inline u8 sbig_inb(struct sbig_client *pd)
 		pr_err("sbiglpt: " fmt, ##arg); \
 } while (0)
 
-long sbig_ioctl(struct sbig_client *pd, unsigned int cmd, unsigned long arg,
-		spinlock_t *spin_lock);
+long sbig_ioctl(struct sbig_client *pd, unsigned int cmd, unsigned long arg);
+long sbig_port_ioctl(struct sbig_client *pd, unsigned int cmd,
+		     unsigned long arg);
+int KLptIdleClearRow(struct sbig_client *pd, enum ccd_request ccd,
+		     enum camera_type cameraID);
+
+void sbig_sched_init(struct sbig_device *sd);
+void sbig_sched_shutdown(struct sbig_device *sd);
+int sbig_sched_begin(struct sbig_client *pd, enum sbig_class cls);
+void sbig_sched_end(struct sbig_client *pd);
+bool sbig_sched_try_idle(struct sbig_device *sd);
+int sbig_sched_yield(struct sbig_client *pd, enum sbig_class cls);
+void sbig_sched_hold_micro(struct sbig_client *pd);
+void sbig_sched_release_micro(struct sbig_client *pd);
+void sbig_row_account(struct sbig_device *sd, u64 ns);
+void sbig_atomic_account(struct sbig_device *sd, u64 ns);
+
+void sbig_model_row(struct sbig_device *sd, int ccd, u32 lines,
+		    u64 vclock_ns, u32 clears, u64 clear_ns, u32 pixels,
+		    u64 pixel_ns);
+u64 sbig_model_predict(struct sbig_device *sd, int ccd, u32 lines,
+		       u32 clears, u32 pixels);
+void sbig_model_error(struct sbig_device *sd, u64 predicted_ns,
+		      u64 actual_ns);
+
+void sbig_idle_init(struct sbig_device *sd);
+int sbig_idle_arm(struct sbig_device *sd, const struct sbig_idle_clear *ic);
+bool sbig_idle_armed(struct sbig_device *sd);
+bool sbig_idle_row(struct sbig_device *sd);
+bool sbig_idle_take(struct sbig_device *sd, int ccd, int cameraID, u32 rows);
+void sbig_idle_touch(struct sbig_device *sd, int ccd);
+void sbig_idle_latency(struct sbig_device *sd, int ccd, u64 ns);
+void sbig_idle_free(struct sbig_device *sd);
+
+void sbig_tdi_init(struct sbig_device *sd);
+void sbig_tdi_open(struct sbig_client *pd);
+void sbig_tdi_release(struct sbig_client *pd);
+int sbig_tdi_begin(struct sbig_client *pd, u32 len, u32 slots,
+		   u64 period_ns);
+u16 *sbig_tdi_slot(struct sbig_client *pd);
+void sbig_tdi_push(struct sbig_client *pd, bool kept, u64 late_ns);
+void sbig_tdi_end(struct sbig_client *pd);
+ssize_t sbig_tdi_read(struct sbig_client *pd, char __user *buf,
+		      size_t count, bool nonblock);
+sbig_poll_t sbig_tdi_poll(struct sbig_client *pd, struct file *file,
+			  poll_table *wait);
+
+void sbig_guide_init(struct sbig_device *sd);
+void sbig_guide_open(struct sbig_client *pd);
+void sbig_guide_release(struct sbig_client *pd);
+int sbig_guide_begin(struct sbig_client *pd,
+		     const struct sbig_guide_stream *gs);
+void sbig_guide_centroid(const u16 *p, u32 len, u32 height,
+			 struct sbig_guide_record *r);
+void sbig_guide_push(struct sbig_client *pd, struct sbig_guide_record *r,
+		     const u16 *pixels, u64 late_ns);
+void sbig_guide_end(struct sbig_client *pd);
+ssize_t sbig_guide_read(struct sbig_client *pd, char __user *buf,
+			size_t count, bool nonblock);
+sbig_poll_t sbig_guide_poll(struct sbig_client *pd, struct file *file,
+			    poll_table *wait);
+
+void sbig_micro_init(struct sbig_device *sd);
+u64 sbig_micro_now(clockid_t clock);
+bool sbig_micro_wait(clockid_t clock, u64 deadline_ns);
+void sbig_micro_spin(clockid_t clock, u64 deadline_ns, u64 spin_ns);
+void sbig_micro_account(struct sbig_device *sd, s64 error_ns);
+
+extern const struct sbig_timing sbig_timing_default;
+void sbig_timing_init(struct sbig_device *sd);
+void sbig_timing_get(struct sbig_device *sd, struct sbig_timing *t);
+void sbig_timing_set_vclock(struct sbig_device *sd, unsigned int ns);
+void sbig_timing_tuned(struct sbig_device *sd, const struct sbig_timing *t);
+void sbig_timing_merged(struct sbig_device *sd, bool first_row, u32 blocks,
+			u32 writes, u64 ns);
+
+void sbig_worker_start(struct sbig_device *sd);
+void sbig_worker_stop(struct sbig_device *sd);
+long sbig_worker_call(struct sbig_client *pd, unsigned int cmd,
+		      unsigned long arg);
+bool sbig_worker_current(struct sbig_device *sd);
+bool sbig_worker_pending(struct sbig_device *sd);
+void sbig_worker_run(struct sbig_device *sd);
+
+void sbig_jitter_begin(struct sbig_client *pd);
+bool sbig_jitter_row(struct sbig_client *pd, u32 row, u64 max_ns);
+void sbig_jitter_end(struct sbig_client *pd, int status);
+void sbig_jitter_add(struct sbig_device *sd);
+
+u8 sbig_rec_command(struct sbig_device *sd, u8 nr);
+void sbig_rec_status(struct sbig_device *sd, int status);
+void sbig_rec_add(struct sbig_device *sd);
+void sbig_rec_free(struct sbig_device *sd);
+
+void sbig_status_progress(struct sbig_device *sd, u32 cmd, u32 row,
+			  u32 total);
+void sbig_status_row(struct sbig_device *sd, u32 row);
+void sbig_status_error(struct sbig_device *sd, int status);
+void sbig_status_add(struct sbig_device *sd, u32 frames, u32 rows,
+		     u32 pixels, u64 bytes);
+int sbig_status_mmap(struct sbig_device *sd, struct vm_area_struct *vma);
+void sbig_status_alloc(struct sbig_device *sd);
+void sbig_status_free(struct sbig_device *sd);
+
+void sbig_stat_ioctl(struct sbig_device *sd, unsigned int nr, u64 ns);
+void sbig_stats_add(struct sbig_device *sd);
+void sbig_stats_remove(struct sbig_device *sd);
+void sbig_stats_free(struct sbig_device *sd);
+void sbig_stats_init(void);
+void sbig_stats_exit(void);
+
+void sbig_wait_start(struct sbig_client *pd, struct sbig_wait *w,
+		     u64 timeout_ns);
+int sbig_wait_next(struct sbig_client *pd, struct sbig_wait *w);
+void sbig_wait_ready(struct sbig_client *pd, struct sbig_wait *w);
+void sbig_wait_ms(struct sbig_client *pd, unsigned int ms);
+bool sbig_wait_until(u64 deadline_ns);
+void sbig_calibrate_io(struct sbig_device *sd);
+
+extern const struct attribute_group sbig_guide_group;
+extern const struct attribute_group sbig_idle_group;
+extern const struct attribute_group sbig_jitter_group;
+extern const struct attribute_group sbig_micro_group;
+extern const struct attribute_group sbig_model_group;
+extern const struct attribute_group sbig_recorder_group;
+extern const struct attribute_group sbig_sched_group;
+extern const struct attribute_group sbig_stats_group;
+extern const struct attribute_group sbig_tdi_group;
+extern const struct attribute_group sbig_timing_group;
+extern const struct attribute_group sbig_wait_group;
+extern const struct attribute_group sbig_worker_group;
 
 #endif /* !_SBIGLPT_MODULE_H */
@@ -0,0 +1,421 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver command scheduler
+ *
+ * Several clients may have the same camera open, e.g. an imaging
+ * application and an autoguider.  Only one of them may drive the port
+ * at a time.  Waiters are admitted in class priority order, and a long
+ * imaging readout yields at row boundaries so queued guide transactions
+ * can run in the gaps.
+ *
+ * The micro protocol is a block sent followed by a reply received in a
+ * separate ioctl.  Other clients are held off between the two so their
+ * CONTROL_OUT writes don't disturb the HSO handshake.
+ *
+ * The readout policy trades CCD clock timing against the latency seen
+ * by the rest of the system.  row_timing shows both sides: the spread
+ * of row readout times, and the longest stretch run with preemption or
+ * interrupts disabled.
+ */
+
+#include <linux/device.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+
+#include "sbiglpt_module.h"
+
+#define MICRO_HOLD_TIMEOUT	(HZ)	// max wait for reply to micro block
+
+static const char *sbig_class_names[SBIG_CLASS_COUNT] = {
+	[SBIG_CLASS_GUIDE] = "guide",
+	[SBIG_CLASS_IMAGING] = "imaging",
+};
+
+void sbig_sched_init(struct sbig_device *sd)
+{
+	struct sbig_sched *s = &sd->sched;
+
+	spin_lock_init(&s->lock);
+	init_waitqueue_head(&s->wait);
+}
+
+/* Return 1 if the port was acquired, -1 if it never will be, else 0.
+ * While a readout yields, only classes above it are let in; reclaim is
+ * the readout taking the port back.
+ */
+static int sbig_sched_try_acquire(struct sbig_sched *s,
+				  struct sbig_client *pd,
+				  enum sbig_class cls, bool reclaim)
+{
+	bool ok;
+	int c;
+
+	spin_lock(&s->lock);
+	if (s->dead) {
+		spin_unlock(&s->lock);
+		return -1;
+	}
+	ok = !s->busy;
+	if (ok && s->yielding && !reclaim && cls >= s->yield_cls)
+		ok = false;
+	for (c = 0; ok && c < cls; c++) {
+		if (s->waiting[c] > 0)
+			ok = false;
+	}
+	if (ok && s->micro_owner && s->micro_owner != pd) {
+		if (time_before(jiffies, s->micro_expires))
+			ok = false;
+		else
+			s->micro_owner = NULL;
+	}
+	if (ok) {
+		s->busy = true;
+		s->owner = pd;
+		s->waiting[cls]--;
+		if (reclaim)
+			s->yielding = false;
+	}
+	spin_unlock(&s->lock);
+	return ok ? 1 : 0;
+}
+
+static bool sbig_sched_idle(struct sbig_sched *s)
+{
+	bool idle;
+
+	spin_lock(&s->lock);
+	idle = !s->busy;
+	spin_unlock(&s->lock);
+	return idle;
+}
+
+static void sbig_sched_account(struct sbig_sched *s, enum sbig_class cls,
+			       u64 ns)
+{
+	struct sbig_sched_stats *st = &s->stats[cls];
+
+	spin_lock(&s->lock);
+	st->count++;
+	st->total_ns += ns;
+	if (st->max_ns < ns)
+		st->max_ns = ns;
+	spin_unlock(&s->lock);
+}
+
+// On the readout thread, also wake up to run queued commands.
+static bool sbig_sched_serve_ready(struct sbig_sched *s,
+				   struct sbig_client *pd,
+				   enum sbig_class cls, bool reclaim,
+				   int *acquired)
+{
+	*acquired = sbig_sched_try_acquire(s, pd, cls, reclaim);
+	return *acquired || sbig_worker_pending(pd->sd);
+}
+
+static int sbig_sched_wait(struct sbig_client *pd, enum sbig_class cls,
+			   bool interruptible, bool reclaim)
+{
+	struct sbig_sched *s = &pd->sd->sched;
+	u64 t0 = ktime_get_ns();
+	bool serve = sbig_worker_current(pd->sd);
+	int acquired = 0;
+	long rc;
+
+	spin_lock(&s->lock);
+	s->waiting[cls]++;
+	spin_unlock(&s->lock);
+
+	// time out periodically to notice an expired micro hold
+	do {
+		if (interruptible) {
+			rc = wait_event_interruptible_timeout(s->wait,
+				(acquired = sbig_sched_try_acquire(s, pd, cls,
+								    reclaim)),
+				MICRO_HOLD_TIMEOUT);
+		} else if (!serve) {
+			rc = wait_event_timeout(s->wait,
+				(acquired = sbig_sched_try_acquire(s, pd, cls,
+								    reclaim)),
+				MICRO_HOLD_TIMEOUT);
+		} else {
+			rc = wait_event_timeout(s->wait,
+				sbig_sched_serve_ready(s, pd, cls, reclaim,
+						       &acquired),
+				MICRO_HOLD_TIMEOUT);
+			if (rc > 0 && !acquired) {
+				sbig_worker_run(pd->sd);
+				rc = 0;
+			}
+		}
+	} while (rc == 0);
+
+	if (rc > 0 && acquired < 0)
+		rc = -ENODEV;
+	if (rc < 0) {
+		spin_lock(&s->lock);
+		s->waiting[cls]--;
+		if (reclaim)
+			s->yielding = false;
+		spin_unlock(&s->lock);
+		wake_up_all(&s->wait); // lower classes may be waiting on us
+		return rc;
+	}
+	sbig_sched_account(s, cls, ktime_get_ns() - t0);
+	return 0;
+}
+
+// Wait for exclusive use of the port.
+int sbig_sched_begin(struct sbig_client *pd, enum sbig_class cls)
+{
+	return sbig_sched_wait(pd, cls, true, false);
+}
+
+// Fail all future port requests, cancel the current one and wait for it
+// to finish.  Commands stop at their next row, see KLptRowDone().
+void sbig_sched_shutdown(struct sbig_device *sd)
+{
+	struct sbig_sched *s = &sd->sched;
+
+	spin_lock(&s->lock);
+	s->dead = true;
+	spin_unlock(&s->lock);
+	wake_up_all(&s->wait);
+	wait_event(s->wait, sbig_sched_idle(s));
+}
+
+// Take the port for idle work if nobody wants it, see idle.c.
+bool sbig_sched_try_idle(struct sbig_device *sd)
+{
+	struct sbig_sched *s = &sd->sched;
+	bool ok;
+	int c;
+
+	spin_lock(&s->lock);
+	ok = !s->dead && !s->busy && !s->yielding;
+	for (c = 0; ok && c < SBIG_CLASS_COUNT; c++) {
+		if (s->waiting[c] > 0)
+			ok = false;
+	}
+	if (ok && s->micro_owner && time_before(jiffies, s->micro_expires))
+		ok = false;
+	if (ok) {
+		s->busy = true;
+		s->owner = sd->idle.pd;
+	}
+	spin_unlock(&s->lock);
+	return ok;
+}
+
+// Give up the port, if it is still ours: after a failed yield it may be
+// in use by whoever was let in.
+void sbig_sched_end(struct sbig_client *pd)
+{
+	struct sbig_sched *s = &pd->sd->sched;
+
+	spin_lock(&s->lock);
+	if (!s->busy || s->owner != pd) {
+		spin_unlock(&s->lock);
+		return;
+	}
+	s->busy = false;
+	s->owner = NULL;
+	spin_unlock(&s->lock);
+	wake_up_all(&s->wait);
+}
+
+// Let any queued higher priority work use the port, then take it back
+// ahead of other work of the same class or lower.  Only call this where
+// the camera can tolerate the pause.  If an error is returned the caller
+// no longer owns the port.
+int sbig_sched_yield(struct sbig_client *pd, enum sbig_class cls)
+{
+	struct sbig_sched *s = &pd->sd->sched;
+	bool pending = false;
+	int c, rc;
+
+	spin_lock(&s->lock);
+	for (c = 0; c < cls; c++) {
+		if (s->waiting[c] > 0)
+			pending = true;
+	}
+	if (pending) {
+		s->yielding = true;
+		s->yield_cls = cls;
+	}
+	spin_unlock(&s->lock);
+
+	if (!pending)
+		return 0;
+	sbig_sched_end(pd);
+	// not interruptible - the caller is in the middle of a readout.
+	// On the readout thread, the commands let in are run meanwhile.
+	rc = sbig_sched_wait(pd, cls, false, true);
+	sbig_rec_pause(pd->sd);
+	return rc;
+}
+
+// Keep other clients off the port until this client fetches its reply.
+void sbig_sched_hold_micro(struct sbig_client *pd)
+{
+	struct sbig_sched *s = &pd->sd->sched;
+
+	spin_lock(&s->lock);
+	s->micro_owner = pd;
+	s->micro_expires = jiffies + MICRO_HOLD_TIMEOUT;
+	spin_unlock(&s->lock);
+}
+
+void sbig_sched_release_micro(struct sbig_client *pd)
+{
+	struct sbig_sched *s = &pd->sd->sched;
+
+	spin_lock(&s->lock);
+	if (s->micro_owner == pd)
+		s->micro_owner = NULL;
+	spin_unlock(&s->lock);
+	wake_up_all(&s->wait);
+}
+
+// Row duration mean and variance by Welford's method.
+void sbig_row_account(struct sbig_device *sd, u64 ns)
+{
+	struct sbig_sched *s = &sd->sched;
+	struct sbig_row_stats *st = &sd->row_stats;
+	s64 delta;
+
+	spin_lock(&s->lock);
+	st->rows++;
+	delta = (s64)(ns - st->mean_ns);
+	st->mean_ns += div64_s64(delta, st->rows);
+	st->m2 += delta * (s64)(ns - st->mean_ns);
+	if (st->min_ns == 0 || st->min_ns > ns)
+		st->min_ns = ns;
+	if (st->max_ns < ns)
+		st->max_ns = ns;
+	spin_unlock(&s->lock);
+}
+
+void sbig_atomic_account(struct sbig_device *sd, u64 ns)
+{
+	struct sbig_sched *s = &sd->sched;
+	struct sbig_row_stats *st = &sd->row_stats;
+
+	spin_lock(&s->lock);
+	st->atomic++;
+	st->atomic_ns += ns;
+	if (st->atomic_max_ns < ns)
+		st->atomic_max_ns = ns;
+	spin_unlock(&s->lock);
+}
+
+static ssize_t queue_latency_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_sched *s = &sd->sched;
+	struct sbig_sched_stats st;
+	ssize_t len = 0;
+	u64 avg;
+	int c;
+
+	for (c = 0; c < SBIG_CLASS_COUNT; c++) {
+		spin_lock(&s->lock);
+		st = s->stats[c];
+		spin_unlock(&s->lock);
+		avg = st.count ? div64_u64(st.total_ns, st.count) : 0;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%s count %llu avg_ns %llu max_ns %llu\n",
+				 sbig_class_names[c], st.count, avg, st.max_ns);
+	}
+	return len;
+}
+static DEVICE_ATTR_RO(queue_latency);
+
+static const char *sbig_policy_names[SBIG_POLICY_COUNT] = {
+	[SBIG_POLICY_PREEMPT] = "preemptible",
+	[SBIG_POLICY_ROW] = "row",
+	[SBIG_POLICY_IRQ] = "irq",
+};
+
+static ssize_t readout_policy_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	enum sbig_readout_policy cur = READ_ONCE(sd->readout_policy);
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < SBIG_POLICY_COUNT; i++) {
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 i == cur ? "[%s]%s" : "%s%s",
+				 sbig_policy_names[i],
+				 i < SBIG_POLICY_COUNT - 1 ? " " : "\n");
+	}
+	return len;
+}
+
+static ssize_t readout_policy_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	int i;
+
+	i = sysfs_match_string(sbig_policy_names, buf);
+	if (i < 0)
+		return i;
+	WRITE_ONCE(sd->readout_policy, i);
+	return count;
+}
+static DEVICE_ATTR_RW(readout_policy);
+
+static ssize_t row_timing_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_sched *s = &sd->sched;
+	struct sbig_row_stats st;
+	u64 var, atomic_avg;
+
+	spin_lock(&s->lock);
+	st = sd->row_stats;
+	spin_unlock(&s->lock);
+	var = st.rows > 1 ? div64_u64(st.m2, st.rows - 1) : 0;
+	atomic_avg = st.atomic ? div64_u64(st.atomic_ns, st.atomic) : 0;
+	return scnprintf(buf, PAGE_SIZE,
+			 "rows %llu mean_ns %llu var_ns2 %llu min_ns %llu max_ns %llu\n"
+			 "atomic %llu avg_ns %llu max_ns %llu\n",
+			 st.rows, st.mean_ns, var, st.min_ns, st.max_ns,
+			 st.atomic, atomic_avg, st.atomic_max_ns);
+}
+
+// Any write clears the statistics.
+static ssize_t row_timing_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_sched *s = &sd->sched;
+
+	spin_lock(&s->lock);
+	memset(&sd->row_stats, 0, sizeof(sd->row_stats));
+	spin_unlock(&s->lock);
+	return count;
+}
+static DEVICE_ATTR_RW(row_timing);
+
+static struct attribute *sbig_sched_attrs[] = {
+	&dev_attr_queue_latency.attr,
+	&dev_attr_readout_policy.attr,
+	&dev_attr_row_timing.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_sched_group = {
+	.attrs = sbig_sched_attrs,
+};
@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver statistics in debugfs
+ *
+ * /sys/kernel/debug/sbiglpt/sbiglptN/stats shows, per device:
+ *	- a log2 latency histogram per ioctl command
+ *	- count and time of busy waits by kind
+ *	- timeouts by kind
+ *	- pixel and micro block bytes copied to and from user space
+ * Write anything to reset to clear them.
+ *
+ * Port reads and writes are bus cycles, the real cost of this driver.
+ * They are counted by what they were for, and port_ops in sysfs shows
+ * them per unit of work, e.g. per pixel digitized, a number that can be
+ * compared across driver versions and parport backends.
+ *
+ * Counters are per-CPU and updated with this_cpu ops, so keeping them
+ * takes no locks and adds nothing to readout timing but a few adds.
+ * A/D and PLD busy time is estimated as polls times the port read cost,
+ * so no clock is read per pixel.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "sbiglpt_module.h"
+
+static struct dentry *sbig_debugfs_root;
+
+static const char *sbig_busy_names[SBIG_BUSY_COUNT] = {
+	[SBIG_BUSY_MICRO] = "micro",
+	[SBIG_BUSY_PLD] = "pld",
+	[SBIG_BUSY_AD] = "ad",
+	[SBIG_BUSY_DELAY] = "delay",
+};
+
+static const char *sbig_timeout_names[SBIG_TIMEOUT_COUNT] = {
+	[SBIG_TIMEOUT_TX] = "micro_tx",
+	[SBIG_TIMEOUT_RX] = "micro_rx",
+	[SBIG_TIMEOUT_PLD] = "pld",
+	[SBIG_TIMEOUT_AD] = "ad",
+};
+
+void sbig_stat_ioctl(struct sbig_device *sd, unsigned int nr, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	int b = us ? min(ilog2(us) + 1, SBIG_HIST_BUCKETS - 1) : 0;
+
+	if (!sd->stats || nr >= SBIG_STATS_NR)
+		return;
+	this_cpu_inc(sd->stats->ioctl_hist[nr][b]);
+	this_cpu_add(sd->stats->ioctl_ns[nr], ns);
+}
+
+static const char *sbig_op_names[SBIG_OP_COUNT] = {
+	[SBIG_OP_OTHER] = "other",
+	[SBIG_OP_DIGITIZE] = "digitize",
+	[SBIG_OP_CLEAR] = "clear",
+	[SBIG_OP_VCLOCK] = "vclock",
+	[SBIG_OP_MICRO] = "micro",
+};
+
+static const char *sbig_op_units[SBIG_OP_COUNT] = {
+	[SBIG_OP_OTHER] = "-",
+	[SBIG_OP_DIGITIZE] = "pixels",
+	[SBIG_OP_CLEAR] = "blocks",
+	[SBIG_OP_VCLOCK] = "lines",
+	[SBIG_OP_MICRO] = "nibbles",
+};
+
+static void sbig_stats_sum(struct sbig_device *sd, struct sbig_stats *sum)
+{
+	struct sbig_stats *st;
+	int cpu, i, b;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(sd->stats, cpu);
+		for (i = 0; i < SBIG_STATS_NR; i++) {
+			for (b = 0; b < SBIG_HIST_BUCKETS; b++)
+				sum->ioctl_hist[i][b] += st->ioctl_hist[i][b];
+			sum->ioctl_ns[i] += st->ioctl_ns[i];
+		}
+		for (i = 0; i < SBIG_BUSY_COUNT; i++) {
+			sum->busy_count[i] += st->busy_count[i];
+			sum->busy_ns[i] += st->busy_ns[i];
+		}
+		for (i = 0; i < SBIG_TIMEOUT_COUNT; i++)
+			sum->timeouts[i] += st->timeouts[i];
+		sum->bytes_in += st->bytes_in;
+		sum->bytes_out += st->bytes_out;
+		for (i = 0; i < SBIG_OP_COUNT; i++) {
+			sum->port_out[i] += st->port_out[i];
+			sum->port_in[i] += st->port_in[i];
+			sum->port_units[i] += st->port_units[i];
+		}
+	}
+}
+
+static int sbig_stats_show(struct seq_file *m, void *v)
+{
+	struct sbig_device *sd = m->private;
+	struct sbig_stats *sum;
+	u64 count;
+	int i, b;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL); // too big for the stack
+	if (!sum)
+		return -ENOMEM;
+	sbig_stats_sum(sd, sum);
+
+	for (i = 0; i < SBIG_STATS_NR; i++) {
+		count = 0;
+		for (b = 0; b < SBIG_HIST_BUCKETS; b++)
+			count += sum->ioctl_hist[i][b];
+		if (count == 0)
+			continue;
+		seq_printf(m, "ioctl %d count %llu avg_ns %llu\n", i, count,
+			   div64_u64(sum->ioctl_ns[i], count));
+		// bucket b > 0 holds [2^(b-1), 2^b) usec
+		for (b = 0; b < SBIG_HIST_BUCKETS; b++) {
+			if (sum->ioctl_hist[i][b] == 0)
+				continue;
+			if (b == SBIG_HIST_BUCKETS - 1)
+				seq_printf(m, "  >= %llu us %u\n",
+					   1ULL << (b - 1),
+					   sum->ioctl_hist[i][b]);
+			else
+				seq_printf(m, "  < %llu us %u\n", 1ULL << b,
+					   sum->ioctl_hist[i][b]);
+		}
+	}
+	for (i = 0; i < SBIG_BUSY_COUNT; i++) {
+		seq_printf(m, "busy %s count %llu ns %llu\n",
+			   sbig_busy_names[i], sum->busy_count[i],
+			   sum->busy_ns[i]);
+	}
+	for (i = 0; i < SBIG_TIMEOUT_COUNT; i++) {
+		seq_printf(m, "timeout %s %llu\n", sbig_timeout_names[i],
+			   sum->timeouts[i]);
+	}
+	seq_printf(m, "bytes in %llu out %llu\n", sum->bytes_in,
+		   sum->bytes_out);
+	kfree(sum);
+	return 0;
+}
+
+// port ops per unit of work, with two decimals
+static ssize_t port_ops_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_stats *sum;
+	ssize_t len = 0;
+	u64 ops, per;
+	u32 rem;
+	int i;
+
+	if (!sd->stats)
+		return -ENODEV;
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+	sbig_stats_sum(sd, sum);
+	for (i = 0; i < SBIG_OP_COUNT; i++) {
+		ops = sum->port_out[i] + sum->port_in[i];
+		per = sum->port_units[i] ?
+			div64_u64(ops * 100, sum->port_units[i]) : 0;
+		per = div_u64_rem(per, 100, &rem);
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%s out %llu in %llu %s %llu per_unit %llu.%02u\n",
+				 sbig_op_names[i], sum->port_out[i],
+				 sum->port_in[i], sbig_op_units[i],
+				 sum->port_units[i], per, rem);
+	}
+	kfree(sum);
+	return len;
+}
+static DEVICE_ATTR_RO(port_ops);
+
+static struct attribute *sbig_stats_attrs[] = {
+	&dev_attr_port_ops.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_stats_group = {
+	.attrs = sbig_stats_attrs,
+};
+
+static int sbig_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sbig_stats_show, inode->i_private);
+}
+
+static const struct file_operations sbig_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = sbig_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static ssize_t sbig_reset_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct sbig_device *sd = file_inode(file)->i_private;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(sd->stats, cpu), 0, sizeof(*sd->stats));
+	return count;
+}
+
+static const struct file_operations sbig_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = sbig_reset_write,
+	.llseek = noop_llseek,
+};
+
+// Allocate the counters and publish them.  Without, nothing is counted.
+void sbig_stats_add(struct sbig_device *sd)
+{
+	char name[16];
+
+	sd->stats = alloc_percpu(struct sbig_stats);
+	if (!sd->stats)
+		return;
+	snprintf(name, sizeof(name), "sbiglpt%d", sd->minor);
+	sd->debugfs = debugfs_create_dir(name, sbig_debugfs_root);
+	debugfs_create_file("stats", 0444, sd->debugfs, sd, &sbig_stats_fops);
+	debugfs_create_file("reset", 0200, sd->debugfs, sd, &sbig_reset_fops);
+}
+
+// Unpublish the counters.  They are freed with the device.
+void sbig_stats_remove(struct sbig_device *sd)
+{
+	debugfs_remove_recursive(sd->debugfs);
+	sd->debugfs = NULL;
+}
+
+void sbig_stats_free(struct sbig_device *sd)
+{
+	free_percpu(sd->stats);
+}
+
+void sbig_stats_init(void)
+{
+	sbig_debugfs_root = debugfs_create_dir("sbiglpt", NULL);
+}
+
+void sbig_stats_exit(void)
+{
+	debugfs_remove_recursive(sbig_debugfs_root);
+}
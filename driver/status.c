@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver status page
+ *
+ * A page per device with what a dashboard or guider wants to know, see
+ * struct sbig_status.  Clients mmap() it read-only and poll it without
+ * system calls, so watching never delays a readout.
+ *
+ * Updates come from the client owning the port, and from read() and
+ * IOCTL_ACCUMULATE of any client, so writers take status_lock.  They are
+ * bracketed by seq, which readers check like a seqcount without a lock.
+ * It can't be a seqcount_t as user space reads it.
+ */
+
+#include <linux/gfp.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+
+#include "sbiglpt.h"
+#include "sbiglpt_module.h"
+
+static struct sbig_status *sbig_status_begin(struct sbig_device *sd)
+{
+	struct sbig_status *st = sd->status;
+
+	if (st) {
+		spin_lock(&sd->status_lock);
+		WRITE_ONCE(st->seq, st->seq + 1);
+		/* odd seq before the fields, pairs with the reader's rmb() */
+		smp_wmb();
+	}
+	return st;
+}
+
+static void sbig_status_end(struct sbig_device *sd, struct sbig_status *st)
+{
+	WRITE_ONCE(st->update_ns, ktime_get_ns());
+	/* fields before even seq, pairs with the reader's rmb() */
+	smp_wmb();
+	WRITE_ONCE(st->seq, st->seq + 1);
+	spin_unlock(&sd->status_lock);
+}
+
+void sbig_status_progress(struct sbig_device *sd, u32 cmd, u32 row,
+			  u32 total)
+{
+	struct sbig_status *st = sbig_status_begin(sd);
+
+	if (!st)
+		return;
+	WRITE_ONCE(st->cmd, cmd);
+	WRITE_ONCE(st->row, row);
+	WRITE_ONCE(st->total, total);
+	sbig_status_end(sd, st);
+}
+
+void sbig_status_row(struct sbig_device *sd, u32 row)
+{
+	struct sbig_status *st = sbig_status_begin(sd);
+
+	if (!st)
+		return;
+	WRITE_ONCE(st->row, row);
+	sbig_status_end(sd, st);
+}
+
+void sbig_status_error(struct sbig_device *sd, int status)
+{
+	struct sbig_status *st = sbig_status_begin(sd);
+
+	if (!st)
+		return;
+	WRITE_ONCE(st->last_error, status);
+	sbig_status_end(sd, st);
+}
+
+void sbig_status_add(struct sbig_device *sd, u32 frames, u32 rows,
+		     u32 pixels, u64 bytes)
+{
+	struct sbig_status *st = sbig_status_begin(sd);
+
+	if (!st)
+		return;
+	WRITE_ONCE(st->frames, st->frames + frames);
+	WRITE_ONCE(st->rows, st->rows + rows);
+	WRITE_ONCE(st->pixels, st->pixels + pixels);
+	WRITE_ONCE(st->bytes, st->bytes + bytes);
+	sbig_status_end(sd, st);
+}
+
+int sbig_status_mmap(struct sbig_device *sd, struct vm_area_struct *vma)
+{
+	if (!sd->status_page)
+		return -ENODEV;
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	return vm_insert_page(vma, vma->vm_start, sd->status_page);
+}
+
+// Without the page, mmap() fails and nothing else changes.
+void sbig_status_alloc(struct sbig_device *sd)
+{
+	spin_lock_init(&sd->status_lock);
+	sd->status_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!sd->status_page)
+		return;
+	sd->status = page_address(sd->status_page);
+	sd->status->size = sizeof(*sd->status);
+}
+
+// The page lives on while mapped, see vm_insert_page().
+void sbig_status_free(struct sbig_device *sd)
+{
+	if (sd->status_page)
+		__free_page(sd->status_page);
+}
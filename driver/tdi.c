@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver drift scan
+ *
+ * In a drift scan (time delay integration) the telescope stands still
+ * and the imaging CCD is shifted a row at the rate stars drift across
+ * it, and each row is digitized as it reaches the serial register.
+ * IOCTL_TDI_SCAN keeps the port for the scan and sleeps on an absolute
+ * hrtimer to the start of each row; port I/O can't be done from the
+ * timer itself.  Deadlines count from the start of the scan, so rows
+ * after a late one catch up rather than the strip being stretched.
+ * Guide transactions get the port between rows as during a readout.
+ *
+ * Rows go in a ring on the client, read() from another thread.  The
+ * scan doesn't wait for the reader, rows that find the ring full are
+ * dropped.  tdi in sysfs shows the last scan: rows, dropped rows, and
+ * how late rows were started, the last, mean and worst, and how many
+ * were a period or more late.
+ */
+
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "sbiglpt.h"
+#include "sbiglpt_module.h"
+
+void sbig_tdi_init(struct sbig_device *sd)
+{
+	spin_lock_init(&sd->tdi.lock);
+}
+
+void sbig_tdi_open(struct sbig_client *pd)
+{
+	struct sbig_tdi_ring *ring = &pd->tdi;
+
+	mutex_init(&ring->read_lock);
+	spin_lock_init(&ring->lock);
+	init_waitqueue_head(&ring->wait);
+}
+
+void sbig_tdi_release(struct sbig_client *pd)
+{
+	vfree(pd->tdi.rows);
+	mutex_destroy(&pd->tdi.read_lock);
+}
+
+// Start a scan, discarding rows left from the last.
+int sbig_tdi_begin(struct sbig_client *pd, u32 len, u32 slots, u64 period_ns)
+{
+	struct sbig_tdi_ring *ring = &pd->tdi;
+	struct sbig_tdi *tdi = &pd->sd->tdi;
+	size_t size = (size_t)len * slots * sizeof(u16);
+
+	if (size / slots / sizeof(u16) != len)
+		return CE_BAD_PARAMETER;
+	mutex_lock(&ring->read_lock);
+	if ((size_t)ring->len * ring->slots * sizeof(u16) != size) {
+		vfree(ring->rows);
+		ring->rows = vmalloc(size);
+		if (!ring->rows) {
+			ring->len = ring->slots = 0;
+			mutex_unlock(&ring->read_lock);
+			return -ENOMEM;
+		}
+	}
+	spin_lock(&ring->lock);
+	ring->len = len;
+	ring->slots = slots;
+	ring->head = ring->tail = 0;
+	ring->done = false;
+	spin_unlock(&ring->lock);
+	WRITE_ONCE(pd->stream, SBIG_STREAM_TDI);
+	mutex_unlock(&ring->read_lock);
+
+	spin_lock(&tdi->lock);
+	memset(&tdi->st, 0, sizeof(tdi->st));
+	tdi->st.running = true;
+	tdi->st.period_ns = period_ns;
+	spin_unlock(&tdi->lock);
+	return CE_NO_ERROR;
+}
+
+// Return the slot for the next row, or NULL if the ring is full.
+u16 *sbig_tdi_slot(struct sbig_client *pd)
+{
+	struct sbig_tdi_ring *ring = &pd->tdi;
+	u64 head, tail;
+
+	spin_lock(&ring->lock);
+	head = ring->head;
+	tail = ring->tail;
+	spin_unlock(&ring->lock);
+	if (head - tail >= ring->slots)
+		return NULL;
+	return ring->rows + (size_t)do_div(head, ring->slots) * ring->len;
+}
+
+// Account a row started late_ns after its deadline, queued if kept.
+void sbig_tdi_push(struct sbig_client *pd, bool kept, u64 late_ns)
+{
+	struct sbig_tdi_ring *ring = &pd->tdi;
+	struct sbig_tdi_stats *st = &pd->sd->tdi.st;
+
+	if (kept) {
+		spin_lock(&ring->lock);
+		ring->head++;
+		spin_unlock(&ring->lock);
+		wake_up_interruptible(&ring->wait);
+	}
+
+	spin_lock(&pd->sd->tdi.lock);
+	st->rows++;
+	if (!kept)
+		st->dropped++;
+	if (late_ns >= st->period_ns)
+		st->late++;
+	st->late_ns += late_ns;
+	st->late_last_ns = late_ns;
+	if (st->late_max_ns < late_ns)
+		st->late_max_ns = late_ns;
+	spin_unlock(&pd->sd->tdi.lock);
+}
+
+void sbig_tdi_end(struct sbig_client *pd)
+{
+	struct sbig_tdi_ring *ring = &pd->tdi;
+
+	spin_lock(&ring->lock);
+	ring->done = true;
+	spin_unlock(&ring->lock);
+	wake_up_interruptible(&ring->wait);
+
+	spin_lock(&pd->sd->tdi.lock);
+	pd->sd->tdi.st.running = false;
+	spin_unlock(&pd->sd->tdi.lock);
+}
+
+static bool sbig_tdi_readable(struct sbig_tdi_ring *ring)
+{
+	bool readable;
+
+	spin_lock(&ring->lock);
+	readable = ring->head != ring->tail || ring->done;
+	spin_unlock(&ring->lock);
+	return readable;
+}
+
+ssize_t sbig_tdi_read(struct sbig_client *pd, char __user *buf,
+		      size_t count, bool nonblock)
+{
+	struct sbig_tdi_ring *ring = &pd->tdi;
+	size_t row_bytes;
+	u64 tail, n, i, slot;
+	ssize_t rc;
+	bool eof;
+
+	for (;;) {
+		if (!sbig_tdi_readable(ring)) {
+			if (nonblock)
+				return -EAGAIN;
+			if (wait_event_interruptible(ring->wait,
+						     sbig_tdi_readable(ring)))
+				return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&ring->read_lock))
+			return -ERESTARTSYS;
+		row_bytes = (size_t)ring->len * sizeof(u16);
+		spin_lock(&ring->lock);
+		tail = ring->tail;
+		n = ring->head - tail;
+		eof = n == 0 && ring->done;
+		if (eof)
+			ring->done = false;
+		spin_unlock(&ring->lock);
+		if (n != 0 || eof)
+			break;
+		mutex_unlock(&ring->read_lock);	// another reader got them
+	}
+
+	rc = 0;
+	if (eof)
+		goto out;
+	if (count < row_bytes) {
+		rc = -EINVAL;
+		goto out;
+	}
+	n = min_t(u64, n, count / row_bytes);
+	for (i = 0; i < n; i++) {
+		slot = tail + i;
+		if (copy_to_user(buf + i * row_bytes, ring->rows +
+				 (size_t)do_div(slot, ring->slots) * ring->len,
+				 row_bytes)) {
+			rc = -EFAULT;
+			break;
+		}
+	}
+	if (i > 0) {
+		spin_lock(&ring->lock);
+		ring->tail += i;
+		spin_unlock(&ring->lock);
+		rc = i * row_bytes;
+		sbig_stat_bytes(pd->sd, 0, rc);
+		sbig_status_add(pd->sd, 0, 0, 0, rc);
+	}
+out:
+	mutex_unlock(&ring->read_lock);
+	return rc;
+}
+
+sbig_poll_t sbig_tdi_poll(struct sbig_client *pd, struct file *file,
+			  poll_table *wait)
+{
+	struct sbig_tdi_ring *ring = &pd->tdi;
+
+	poll_wait(file, &ring->wait, wait);
+	return sbig_tdi_readable(ring) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static ssize_t tdi_show(struct device *dev, struct device_attribute *attr,
+			char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_tdi_stats t;
+
+	spin_lock(&sd->tdi.lock);
+	t = sd->tdi.st;
+	spin_unlock(&sd->tdi.lock);
+
+	return scnprintf(buf, PAGE_SIZE,
+			 "running %d period_ns %llu rows %llu dropped %llu late %llu late_last_ns %llu late_mean_ns %llu late_max_ns %llu\n",
+			 t.running, t.period_ns, t.rows, t.dropped, t.late,
+			 t.late_last_ns,
+			 t.rows ? div64_u64(t.late_ns, t.rows) : 0,
+			 t.late_max_ns);
+}
+static DEVICE_ATTR_RO(tdi);
+
+static struct attribute *sbig_tdi_attrs[] = {
+	&dev_attr_tdi.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_tdi_group = {
+	.attrs = sbig_tdi_attrs,
+};
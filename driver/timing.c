@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver clock timing
+ *
+ * The CCD clock delays were compile-time constants sized for 2002 PCs.
+ * They are per device now, in sysfs, and grouped in profiles:
+ *	default	the original constants
+ *	tuned	found by the last IOCTL_AUTOTUNE, see ioctl.c
+ *	custom	anything set by hand
+ * Writing a profile name to timing_profile switches to it.
+ *
+ * Profiles last as long as the device.  To keep tuned values across
+ * reboots, set the attributes from a udev rule, see udev/.
+ *
+ * The A/D settle time is learned on every readout, see ad_adaptive.
+ *
+ * merge_clears leaves the pixels right of a row in the serial register
+ * when another row of the imaging CCD is read next, as its vertical
+ * clock begins by clearing the whole register.  merged_clears shows
+ * what that saved, with the time estimated from the readout model.
+ * Compare bias frames with it on and off before relying on it.
+ */
+
+#include <linux/device.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+
+#include "sbiglpt_module.h"
+
+const struct sbig_timing sbig_timing_default = {
+	.vclock_delay_ns = 10000,	// between vertical clocks on the
+					//  imaging CCD (was 10 ISA port reads)
+	.st1k_vclock_x = 10,		// multiplier for VClock an ST1K
+	.dump_ratio = 5,		// after every N vertical clocks
+					//  do a full horizontal clock on
+	.idle_state_ms = 55 * 3,	// time to force idle at start of packet
+	.merge_clears = 0,
+};
+
+static const char * const sbig_timing_profile_names[SBIG_TIMING_COUNT] = {
+	[SBIG_TIMING_DEFAULT] = "default",
+	[SBIG_TIMING_TUNED] = "tuned",
+	[SBIG_TIMING_CUSTOM] = "custom",
+};
+
+void sbig_timing_init(struct sbig_device *sd)
+{
+	sd->timing = sbig_timing_default;
+	sd->timing_profile = SBIG_TIMING_DEFAULT;
+}
+
+void sbig_timing_get(struct sbig_device *sd, struct sbig_timing *t)
+{
+	spin_lock(&sd->timing_lock);
+	*t = sd->timing;
+	spin_unlock(&sd->timing_lock);
+}
+
+// Try a vertical clock delay, leaving the profile as it is.
+void sbig_timing_set_vclock(struct sbig_device *sd, unsigned int ns)
+{
+	spin_lock(&sd->timing_lock);
+	WRITE_ONCE(sd->timing.vclock_delay_ns, ns);
+	spin_unlock(&sd->timing_lock);
+}
+
+// Keep the result of an auto-tune as the tuned profile and use it.
+void sbig_timing_tuned(struct sbig_device *sd, const struct sbig_timing *t)
+{
+	spin_lock(&sd->timing_lock);
+	sd->timing_tuned = *t;
+	sd->timing = *t;
+	sd->timing_profile = SBIG_TIMING_TUNED;
+	sd->timing_has_tuned = true;
+	spin_unlock(&sd->timing_lock);
+}
+
+// Account a row whose right clear was left to the next row.
+void sbig_timing_merged(struct sbig_device *sd, bool first_row, u32 blocks,
+			u32 writes, u64 ns)
+{
+	struct sbig_merged *m = &sd->merged;
+
+	spin_lock(&sd->timing_lock);
+	if (first_row)
+		m->frames++;
+	m->rows++;
+	m->blocks += blocks;
+	m->writes += writes;
+	m->ns += ns;
+	spin_unlock(&sd->timing_lock);
+}
+
+static ssize_t timing_profile_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	ssize_t len = 0;
+	int i;
+
+	spin_lock(&sd->timing_lock);
+	for (i = 0; i < SBIG_TIMING_COUNT; i++) {
+		if (i == SBIG_TIMING_TUNED && !sd->timing_has_tuned)
+			continue;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 i == sd->timing_profile ? "[%s] " : "%s ",
+				 sbig_timing_profile_names[i]);
+	}
+	spin_unlock(&sd->timing_lock);
+	buf[len - 1] = '\n';
+	return len;
+}
+
+static ssize_t timing_profile_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	int i, rc = 0;
+
+	i = sysfs_match_string(sbig_timing_profile_names, buf);
+	if (i < 0)
+		return i;
+	spin_lock(&sd->timing_lock);
+	switch (i) {
+	case SBIG_TIMING_DEFAULT:
+		sd->timing = sbig_timing_default;
+		break;
+	case SBIG_TIMING_TUNED:
+		if (sd->timing_has_tuned)
+			sd->timing = sd->timing_tuned;
+		else
+			rc = -ENOENT;
+		break;
+	default:
+		break;
+	}
+	if (rc == 0)
+		sd->timing_profile = i;
+	spin_unlock(&sd->timing_lock);
+	return rc < 0 ? rc : count;
+}
+static DEVICE_ATTR_RW(timing_profile);
+
+static ssize_t sbig_timing_show(struct device *dev, char *buf, size_t off)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	unsigned int *val = (void *)&sd->timing + off;
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(*val));
+}
+
+// Setting a value by hand makes the profile custom.
+static ssize_t sbig_timing_store(struct device *dev, const char *buf,
+				 size_t count, size_t off, unsigned int min)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	unsigned int *val = (void *)&sd->timing + off;
+	unsigned int v;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &v);
+	if (rc < 0)
+		return rc;
+	if (v < min)
+		return -EINVAL;
+	spin_lock(&sd->timing_lock);
+	WRITE_ONCE(*val, v);
+	sd->timing_profile = SBIG_TIMING_CUSTOM;
+	spin_unlock(&sd->timing_lock);
+	return count;
+}
+
+#define SBIG_TIMING_ATTR(name, min)					\
+static ssize_t name##_show(struct device *dev,				\
+			   struct device_attribute *attr, char *buf)	\
+{									\
+	return sbig_timing_show(dev, buf,				\
+				offsetof(struct sbig_timing, name));	\
+}									\
+static ssize_t name##_store(struct device *dev,				\
+			    struct device_attribute *attr,		\
+			    const char *buf, size_t count)		\
+{									\
+	return sbig_timing_store(dev, buf, count,			\
+				 offsetof(struct sbig_timing, name), min); \
+}									\
+static DEVICE_ATTR_RW(name)
+
+SBIG_TIMING_ATTR(vclock_delay_ns, 0);
+SBIG_TIMING_ATTR(st1k_vclock_x, 1);
+SBIG_TIMING_ATTR(dump_ratio, 1);
+SBIG_TIMING_ATTR(idle_state_ms, 0);
+SBIG_TIMING_ATTR(merge_clears, 0);
+
+static ssize_t merged_clears_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_merged m;
+	u64 n;
+
+	spin_lock(&sd->timing_lock);
+	m = sd->merged;
+	spin_unlock(&sd->timing_lock);
+	n = max_t(u64, m.frames, 1);
+	return scnprintf(buf, PAGE_SIZE,
+			 "frames %llu rows %llu blocks %llu writes %llu ns %llu per_frame blocks %llu writes %llu ns %llu\n",
+			 m.frames, m.rows, m.blocks, m.writes, m.ns,
+			 div64_u64(m.blocks, n), div64_u64(m.writes, n),
+			 div64_u64(m.ns, n));
+}
+static DEVICE_ATTR_RO(merged_clears);
+
+static struct attribute *sbig_timing_attrs[] = {
+	&dev_attr_timing_profile.attr,
+	&dev_attr_vclock_delay_ns.attr,
+	&dev_attr_st1k_vclock_x.attr,
+	&dev_attr_dump_ratio.attr,
+	&dev_attr_idle_state_ms.attr,
+	&dev_attr_merge_clears.attr,
+	&dev_attr_merged_clears.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_timing_group = {
+	.attrs = sbig_timing_attrs,
+};
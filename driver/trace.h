@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* SBIG astronomy camera parallel port driver tracepoints
+ *
+ * e.g.	trace-cmd record -e sbiglpt
+ *	perf trace -e 'sbiglpt:*'
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM sbiglpt
+
+#if !defined(_SBIGLPT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SBIGLPT_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "sbiglpt.h"
+
+TRACE_DEFINE_ENUM(CE_NO_ERROR);
+TRACE_DEFINE_ENUM(CE_BAD_PARAMETER);
+TRACE_DEFINE_ENUM(CE_TX_TIMEOUT);
+TRACE_DEFINE_ENUM(CE_RX_TIMEOUT);
+TRACE_DEFINE_ENUM(CE_NAK_RECEIVED);
+TRACE_DEFINE_ENUM(CE_CAN_RECEIVED);
+TRACE_DEFINE_ENUM(CE_UNKNOWN_RESPONSE);
+TRACE_DEFINE_ENUM(CE_BAD_LENGTH);
+TRACE_DEFINE_ENUM(CE_AD_TIMEOUT);
+
+#define show_par_error(status) __print_symbolic(status,		\
+	{ CE_NO_ERROR,		"ok" },					\
+	{ CE_BAD_PARAMETER,	"bad_parameter" },			\
+	{ CE_TX_TIMEOUT,	"tx_timeout" },				\
+	{ CE_RX_TIMEOUT,	"rx_timeout" },				\
+	{ CE_NAK_RECEIVED,	"nak" },				\
+	{ CE_CAN_RECEIVED,	"can" },				\
+	{ CE_UNKNOWN_RESPONSE,	"unknown_response" },			\
+	{ CE_BAD_LENGTH,	"bad_length" },				\
+	{ CE_AD_TIMEOUT,	"ad_timeout" })
+
+TRACE_EVENT(sbig_ioctl_enter,
+	TP_PROTO(int minor, unsigned int cmd, unsigned long arg),
+	TP_ARGS(minor, cmd, arg),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(unsigned int, nr)
+		__field(unsigned long, arg)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->nr = _IOC_NR(cmd);
+		__entry->arg = arg;
+	),
+	TP_printk("sbiglpt%d nr=%u arg=0x%lx",
+		  __entry->minor, __entry->nr, __entry->arg)
+);
+
+TRACE_EVENT(sbig_ioctl_exit,
+	TP_PROTO(int minor, unsigned int cmd, long status),
+	TP_ARGS(minor, cmd, status),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(unsigned int, nr)
+		__field(long, status)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->nr = _IOC_NR(cmd);
+		__entry->status = status;
+	),
+	TP_printk("sbiglpt%d nr=%u status=%ld",
+		  __entry->minor, __entry->nr, __entry->status)
+);
+
+TRACE_EVENT(sbig_row_start,
+	TP_PROTO(int minor, const struct ioc_get_area_params *gap, int row),
+	TP_ARGS(minor, gap, row),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(int, row)
+		__field(s16, ccd)
+		__field(s16, left)
+		__field(s16, len)
+		__field(s16, right)
+		__field(s16, horzBin)
+		__field(s16, vertBin)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->row = row;
+		__entry->ccd = gap->ccd;
+		__entry->left = gap->left;
+		__entry->len = gap->len;
+		__entry->right = gap->right;
+		__entry->horzBin = gap->horzBin;
+		__entry->vertBin = gap->vertBin;
+	),
+	TP_printk("sbiglpt%d row=%d ccd=%d left=%d len=%d right=%d bin=%dx%d",
+		  __entry->minor, __entry->row, __entry->ccd, __entry->left,
+		  __entry->len, __entry->right, __entry->horzBin,
+		  __entry->vertBin)
+);
+
+TRACE_EVENT(sbig_row_end,
+	TP_PROTO(int minor, int row, int status),
+	TP_ARGS(minor, row, status),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(int, row)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->row = row;
+		__entry->status = status;
+	),
+	TP_printk("sbiglpt%d row=%d status=%s", __entry->minor, __entry->row,
+		  show_par_error(__entry->status))
+);
+
+// row with uneven A/D trigger spacing, see jitter.c
+TRACE_EVENT(sbig_row_jitter,
+	TP_PROTO(int minor, int row, u64 max_ns),
+	TP_ARGS(minor, row, max_ns),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(int, row)
+		__field(u64, max_ns)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->row = row;
+		__entry->max_ns = max_ns;
+	),
+	TP_printk("sbiglpt%d row=%d max_ns=%llu", __entry->minor,
+		  __entry->row, __entry->max_ns)
+);
+
+// CCD clocking phases, with the time they took
+DECLARE_EVENT_CLASS(sbig_phase,
+	TP_PROTO(int minor, int ccd, int count, u64 ns),
+	TP_ARGS(minor, ccd, count, ns),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(int, ccd)
+		__field(int, count)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->ccd = ccd;
+		__entry->count = count;
+		__entry->ns = ns;
+	),
+	TP_printk("sbiglpt%d ccd=%d count=%d ns=%llu", __entry->minor,
+		  __entry->ccd, __entry->count, __entry->ns)
+);
+
+DEFINE_EVENT(sbig_phase, sbig_vclock,
+	TP_PROTO(int minor, int ccd, int count, u64 ns),
+	TP_ARGS(minor, ccd, count, ns)
+);
+
+DEFINE_EVENT(sbig_phase, sbig_block_clear,
+	TP_PROTO(int minor, int ccd, int count, u64 ns),
+	TP_ARGS(minor, ccd, count, ns)
+);
+
+DECLARE_EVENT_CLASS(sbig_micro_start,
+	TP_PROTO(int minor, unsigned long len),
+	TP_ARGS(minor, len),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(unsigned long, len)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->len = len;
+	),
+	TP_printk("sbiglpt%d len=%lu", __entry->minor, __entry->len)
+);
+
+DEFINE_EVENT(sbig_micro_start, sbig_micro_send_start,
+	TP_PROTO(int minor, unsigned long len),
+	TP_ARGS(minor, len)
+);
+
+DEFINE_EVENT(sbig_micro_start, sbig_micro_get_start,
+	TP_PROTO(int minor, unsigned long len),
+	TP_ARGS(minor, len)
+);
+
+// status tells NAK, CAN and timeouts apart
+DECLARE_EVENT_CLASS(sbig_micro_end,
+	TP_PROTO(int minor, int nibbles, int status, u64 ns),
+	TP_ARGS(minor, nibbles, status, ns),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(int, nibbles)
+		__field(int, status)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->nibbles = nibbles;
+		__entry->status = status;
+		__entry->ns = ns;
+	),
+	TP_printk("sbiglpt%d nibbles=%d status=%s ns=%llu", __entry->minor,
+		  __entry->nibbles, show_par_error(__entry->status),
+		  __entry->ns)
+);
+
+DEFINE_EVENT(sbig_micro_end, sbig_micro_send_end,
+	TP_PROTO(int minor, int nibbles, int status, u64 ns),
+	TP_ARGS(minor, nibbles, status, ns)
+);
+
+DEFINE_EVENT(sbig_micro_end, sbig_micro_get_end,
+	TP_PROTO(int minor, int nibbles, int status, u64 ns),
+	TP_ARGS(minor, nibbles, status, ns)
+);
+
+// A/D and PLD busy polls
+DECLARE_EVENT_CLASS(sbig_conversion,
+	TP_PROTO(int minor, unsigned int polls, u64 ns, bool timeout),
+	TP_ARGS(minor, polls, ns, timeout),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(unsigned int, polls)
+		__field(u64, ns)
+		__field(bool, timeout)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->polls = polls;
+		__entry->ns = ns;
+		__entry->timeout = timeout;
+	),
+	TP_printk("sbiglpt%d polls=%u ns=%llu%s", __entry->minor,
+		  __entry->polls, __entry->ns,
+		  __entry->timeout ? " timeout" : "")
+);
+
+DEFINE_EVENT(sbig_conversion, sbig_ad_wait,
+	TP_PROTO(int minor, unsigned int polls, u64 ns, bool timeout),
+	TP_ARGS(minor, polls, ns, timeout)
+);
+
+DEFINE_EVENT(sbig_conversion, sbig_pld_wait,
+	TP_PROTO(int minor, unsigned int polls, u64 ns, bool timeout),
+	TP_ARGS(minor, polls, ns, timeout)
+);
+
+#endif /* _SBIGLPT_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
@@ -0,0 +1,314 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver waits and delays
+ *
+ * The micro handshake usually completes within a few microseconds, but
+ * the micro may take many milliseconds to answer a command.  Poll
+ * without sleeping for spin_us, then sleep between polls, doubling the
+ * sleep from sleep_min_us up to sleep_max_us.  Time spent asleep is
+ * CPU time given back to the rest of the system; the last sleep of a
+ * wait bounds the latency added by sleeping.
+ *
+ * Usage:
+ *	sbig_wait_start(pd, &w, timeout_ns);
+ *	while (!ready(pd)) {
+ *		if (sbig_wait_next(pd, &w) < 0)
+ *			timed out
+ *	}
+ *	sbig_wait_ready(pd, &w);
+ *
+ * Short CCD clock delays used to be counted in port reads, whose cost
+ * ranges from about 1us on an ISA-timed parport_pc to a small fraction
+ * of that on GPIO backends.  The cost of a read is measured when a port
+ * is attached so delays can be given in nanoseconds.
+ */
+
+#include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+
+#include "sbiglpt_module.h"
+
+#define SBIG_WAIT_UNTIL_NS	(100 * NSEC_PER_MSEC)	// cancel latency
+
+static unsigned int spin_us = 200;
+module_param(spin_us, uint, 0644);
+MODULE_PARM_DESC(spin_us, "Busy-poll this long before sleeping (usec)");
+
+static unsigned int sleep_min_us = 50;
+module_param(sleep_min_us, uint, 0644);
+MODULE_PARM_DESC(sleep_min_us, "First sleep between polls (usec)");
+
+static unsigned int sleep_max_us = 1000;
+module_param(sleep_max_us, uint, 0644);
+MODULE_PARM_DESC(sleep_max_us, "Longest sleep between polls (usec)");
+
+static char *io_read_ns[SBIG_MINORS];
+static int io_read_ns_count;
+module_param_array(io_read_ns, charp, &io_read_ns_count, 0444);
+MODULE_PARM_DESC(io_read_ns,
+		 "Port read costs from sysfs as port:ns, e.g. parport0:850 - skips calibration");
+
+#define CALIBRATE_READS		1000
+#define CALIBRATE_PASSES	3
+
+void sbig_wait_start(struct sbig_client *pd, struct sbig_wait *w,
+		     u64 timeout_ns)
+{
+	w->start = ktime_get_ns();
+	w->deadline = w->start + timeout_ns;
+	w->polls = 0;
+	w->sleep_us = 0;
+	w->slept_ns = 0;
+	w->last_sleep_ns = 0;
+}
+
+static void sbig_wait_account(struct sbig_client *pd, struct sbig_wait *w,
+			      u64 now)
+{
+	struct sbig_wait_stats *st = &pd->sd->wait_stats;
+
+	st->waits++;
+	st->wait_ns += now - w->start;
+	st->sleep_ns += w->slept_ns;
+	sbig_stat_busy(pd->sd, SBIG_BUSY_MICRO,
+		       now - w->start - w->slept_ns);
+	if (w->slept_ns > 0) {
+		st->sleeps++;
+		st->late_ns += w->last_sleep_ns;
+	}
+}
+
+// Call after a failed poll.  Returns -ETIMEDOUT once the deadline passes.
+int sbig_wait_next(struct sbig_client *pd, struct sbig_wait *w)
+{
+	u64 now = ktime_get_ns();
+	unsigned int max_us;
+
+	w->polls++;
+	if (now >= w->deadline) {
+		pd->sd->wait_stats.timeouts++;
+		sbig_wait_account(pd, w, now);
+		return -ETIMEDOUT;
+	}
+	if (now - w->start < (u64)READ_ONCE(spin_us) * NSEC_PER_USEC) {
+		cpu_relax();
+		return 0;
+	}
+	max_us = max(READ_ONCE(sleep_max_us), 1U);
+	if (w->sleep_us == 0)
+		w->sleep_us = clamp(READ_ONCE(sleep_min_us), 1U, max_us);
+	usleep_range(w->sleep_us, w->sleep_us + w->sleep_us / 2);
+	sbig_rec_pause(pd->sd);
+	w->last_sleep_ns = ktime_get_ns() - now;
+	w->slept_ns += w->last_sleep_ns;
+	w->sleep_us = min(w->sleep_us * 2, max_us);
+	return 0;
+}
+
+// Call after a successful poll.  Re-arms w for another wait.
+void sbig_wait_ready(struct sbig_client *pd, struct sbig_wait *w)
+{
+	u64 timeout_ns = w->deadline - w->start;
+
+	if (w->polls > 0)
+		sbig_wait_account(pd, w, ktime_get_ns());
+	sbig_wait_start(pd, w, timeout_ns);
+}
+
+// Sleep for a fixed delay that previously was a busy wait.
+void sbig_wait_ms(struct sbig_client *pd, unsigned int ms)
+{
+	u64 t0 = ktime_get_ns();
+
+	msleep(ms);
+	sbig_rec_pause(pd->sd);
+	pd->sd->wait_stats.delay_ns += ktime_get_ns() - t0;
+}
+
+/* Sleep towards deadline_ns on CLOCK_MONOTONIC, on an absolute hrtimer.
+ * Returns TRUE if it is still ahead, after at most SBIG_WAIT_UNTIL_NS,
+ * so the caller can look for IOCTL_CANCEL.
+ */
+bool sbig_wait_until(u64 deadline_ns)
+{
+	u64 now = ktime_get_ns();
+	ktime_t t;
+
+	if (now >= deadline_ns)
+		return false;
+	t = ns_to_ktime(min(deadline_ns, now + SBIG_WAIT_UNTIL_NS));
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_hrtimeout_range(&t, 0, HRTIMER_MODE_ABS);
+	return ktime_get_ns() < deadline_ns;
+}
+
+/* Find the read cost given for a port in the module parameter.  Minors
+ * follow the order ports attach in, so values are keyed by port name.
+ */
+static unsigned int sbig_io_read_param(struct parport *port)
+{
+	size_t len = strlen(port->name);
+	unsigned int ns;
+	int i;
+
+	for (i = 0; i < io_read_ns_count; i++) {
+		if (strncmp(io_read_ns[i], port->name, len) == 0 &&
+		    io_read_ns[i][len] == ':' &&
+		    kstrtouint(io_read_ns[i] + len + 1, 0, &ns) == 0)
+			return ns;
+	}
+	return 0;
+}
+
+// Measure the cost of a port read, or take it from the module parameter.
+void sbig_calibrate_io(struct sbig_device *sd)
+{
+	struct parport *port = sd->port;
+	u64 t0, ns, best = U64_MAX;
+	int i, pass;
+
+	sd->io_read_ns = sbig_io_read_param(port);
+	if (sd->io_read_ns > 0)
+		return;
+	// best of several passes in case we were interrupted
+	for (pass = 0; pass < CALIBRATE_PASSES; pass++) {
+		t0 = ktime_get_ns();
+		for (i = 0; i < CALIBRATE_READS; i++)
+			port->ops->read_status(port);
+		ns = ktime_get_ns() - t0;
+		if (best > ns)
+			best = ns;
+	}
+	sd->io_read_ns = max_t(u64, div_u64(best, CALIBRATE_READS), 1);
+}
+
+static ssize_t io_read_ns_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(sd->io_read_ns));
+}
+
+static ssize_t io_read_ns_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	unsigned int val;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &val);
+	if (rc < 0)
+		return rc;
+	if (val == 0)
+		return -EINVAL;
+	WRITE_ONCE(sd->io_read_ns, val);
+	return count;
+}
+static DEVICE_ATTR_RW(io_read_ns);
+
+static ssize_t io_delay_reads_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(sd->io_delay_reads));
+}
+
+static ssize_t io_delay_reads_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	bool val;
+	int rc;
+
+	rc = kstrtobool(buf, &val);
+	if (rc < 0)
+		return rc;
+	WRITE_ONCE(sd->io_delay_reads, val);
+	return count;
+}
+static DEVICE_ATTR_RW(io_delay_reads);
+
+static ssize_t conversion_stats_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_poll_stats st[2] = { sd->ad_polls, sd->pld_polls };
+	const char *names[2] = { "ad", "pld" };
+	ssize_t len = 0;
+	u64 avg;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		avg = st[i].waits ? div64_u64(st[i].polls, st[i].waits) : 0;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+			"%s waits %llu timeouts %llu polls min %u avg %llu max %u\n",
+			names[i], st[i].waits, st[i].timeouts,
+			st[i].min_polls, avg, st[i].max_polls);
+	}
+	len += scnprintf(buf + len, PAGE_SIZE - len, "ad_settle_ns %u\n",
+			 sd->ad_settle_ns);
+	return len;
+}
+static DEVICE_ATTR_RO(conversion_stats);
+
+static ssize_t ad_adaptive_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(sd->ad_adaptive));
+}
+
+static ssize_t ad_adaptive_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	bool val;
+	int rc;
+
+	rc = kstrtobool(buf, &val);
+	if (rc < 0)
+		return rc;
+	WRITE_ONCE(sd->ad_adaptive, val);
+	return count;
+}
+static DEVICE_ATTR_RW(ad_adaptive);
+
+static ssize_t wait_stats_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	struct sbig_wait_stats st = sd->wait_stats;
+
+	return scnprintf(buf, PAGE_SIZE,
+			 "waits %llu timeouts %llu sleeps %llu\n"
+			 "spin_ns %llu sleep_ns %llu late_ns %llu delay_ns %llu\n",
+			 st.waits, st.timeouts, st.sleeps,
+			 st.wait_ns - st.sleep_ns, st.sleep_ns, st.late_ns,
+			 st.delay_ns);
+}
+static DEVICE_ATTR_RO(wait_stats);
+
+static struct attribute *sbig_wait_attrs[] = {
+	&dev_attr_wait_stats.attr,
+	&dev_attr_io_read_ns.attr,
+	&dev_attr_io_delay_reads.attr,
+	&dev_attr_conversion_stats.attr,
+	&dev_attr_ad_adaptive.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_wait_group = {
+	.attrs = sbig_wait_attrs,
+};
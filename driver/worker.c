@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* SBIG astronomy camera parallel port driver readout thread
+ *
+ * Each device has a kernel thread that performs all of its port I/O.
+ * The calling task still waits its turn in the command scheduler, then
+ * hands the command to the thread and sleeps until it is done.  The
+ * thread borrows the caller's mm so the command handlers can copy to and
+ * from user space as before.
+ *
+ * The thread can be pinned to a CPU and run SCHED_FIFO, e.g. on a core
+ * set aside with isolcpus= and nohz_full=, so pixel timing doesn't depend
+ * on what the application's own threads are doing.  Use readout_cpu and
+ * readout_priority in sysfs, or the module parameters of the same name
+ * for the default.
+ *
+ * While an imaging readout yields the port between rows, the thread runs
+ * the commands of the clients that were let in, see sbig_sched_yield().
+ * When the port is idle it may clear CCD rows, see idle.c.
+ */
+
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
+#include <linux/cpumask.h>
+#include <linux/device.h>
+#include <linux/kthread.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/types.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+#include <linux/mmu_context.h>
+#include <linux/uaccess.h>
+#endif
+
+#include "sbiglpt_module.h"
+
+static int readout_cpu = -1;
+module_param(readout_cpu, int, 0644);
+MODULE_PARM_DESC(readout_cpu, "Default readout thread CPU (-1 = any)");
+
+static unsigned int readout_priority;
+module_param(readout_priority, uint, 0644);
+MODULE_PARM_DESC(readout_priority,
+		 "Default readout thread SCHED_FIFO priority (0 = SCHED_NORMAL)");
+
+struct sbig_work {
+	struct list_head list;
+	struct sbig_client *pd;
+	unsigned int cmd;
+	unsigned long arg;
+	struct mm_struct *mm;
+	long ret;
+	struct completion done;
+};
+
+static int sbig_worker_set_cpu(struct sbig_device *sd, int cpu)
+{
+	const struct cpumask *mask = cpu_possible_mask;
+
+	if (cpu >= 0) {
+		if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+			return -EINVAL;
+		mask = cpumask_of(cpu);
+	}
+	return set_cpus_allowed_ptr(sd->worker.task, mask);
+}
+
+static int sbig_worker_set_priority(struct sbig_device *sd,
+				    unsigned int prio)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	struct sched_attr attr = {
+		.size = sizeof(attr),
+		.sched_policy = prio ? SCHED_FIFO : SCHED_NORMAL,
+		.sched_priority = prio,
+	};
+
+	if (prio >= MAX_RT_PRIO)
+		return -EINVAL;
+	return sched_setattr_nocheck(sd->worker.task, &attr);
+#else
+	struct sched_param param = { .sched_priority = prio };
+
+	if (prio >= MAX_RT_PRIO)
+		return -EINVAL;
+	return sched_setscheduler_nocheck(sd->worker.task,
+					  prio ? SCHED_FIFO : SCHED_NORMAL,
+					  &param);
+#endif
+}
+
+bool sbig_worker_current(struct sbig_device *sd)
+{
+	return sd->worker.task == current;
+}
+
+bool sbig_worker_pending(struct sbig_device *sd)
+{
+	struct sbig_worker *w = &sd->worker;
+	bool pending;
+
+	spin_lock(&w->lock);
+	pending = !list_empty(&w->queue);
+	spin_unlock(&w->lock);
+	return pending;
+}
+
+static void sbig_worker_use_mm(struct mm_struct *mm)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	kthread_use_mm(mm);
+#else
+	use_mm(mm);
+#endif
+}
+
+static void sbig_worker_unuse_mm(struct mm_struct *mm)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	kthread_unuse_mm(mm);
+#else
+	unuse_mm(mm);
+#endif
+}
+
+/* Run the oldest queued command, if any.  During a yield this is nested
+ * in a readout using another mm, which is put back after.
+ */
+void sbig_worker_run(struct sbig_device *sd)
+{
+	struct sbig_worker *w = &sd->worker;
+	struct mm_struct *outer = current->mm;
+	struct sbig_work *work;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+	mm_segment_t old_fs;
+#endif
+
+	spin_lock(&w->lock);
+	work = list_first_entry_or_null(&w->queue, struct sbig_work, list);
+	if (work)
+		list_del(&work->list);
+	spin_unlock(&w->lock);
+	if (!work)
+		return;
+
+	if (outer)
+		sbig_worker_unuse_mm(outer);
+	sbig_worker_use_mm(work->mm);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	work->ret = sbig_port_ioctl(work->pd, work->cmd, work->arg);
+#else
+	old_fs = get_fs();
+	set_fs(USER_DS);
+	work->ret = sbig_port_ioctl(work->pd, work->cmd, work->arg);
+	set_fs(old_fs);
+#endif
+	sbig_worker_unuse_mm(work->mm);
+	if (outer)
+		sbig_worker_use_mm(outer);
+	complete(&work->done);
+}
+
+static int sbig_worker_fn(void *data)
+{
+	struct sbig_device *sd = data;
+	struct sbig_worker *w = &sd->worker;
+	unsigned int pause;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(w->wait, sbig_worker_pending(sd) ||
+					 sbig_idle_armed(sd) ||
+					 kthread_should_stop());
+		if (!sbig_worker_pending(sd) && sbig_idle_armed(sd)) {
+			// back off a while if the port is in use
+			pause = sbig_idle_row(sd) ? READ_ONCE(sd->idle.pause_us)
+						  : SBIG_IDLE_BUSY_US;
+			wait_event_interruptible_hrtimeout(w->wait,
+				sbig_worker_pending(sd) ||
+				kthread_should_stop(),
+				us_to_ktime(pause));
+			cond_resched();
+		}
+		sbig_worker_run(sd);
+	}
+	return 0;
+}
+
+/* Run a port command on the readout thread.  The caller must own the
+ * port.  The thread is using the caller's mm and stack, so a fatal
+ * signal only asks it to stop at the next row, and we still wait.
+ */
+long sbig_worker_call(struct sbig_client *pd, unsigned int cmd,
+		      unsigned long arg)
+{
+	struct sbig_device *sd = pd->sd;
+	struct sbig_worker *w = &sd->worker;
+	struct sbig_work work = {
+		.pd = pd,
+		.cmd = cmd,
+		.arg = arg,
+		.mm = current->mm,
+	};
+
+	if (!w->task || !work.mm || sbig_worker_current(sd))
+		return sbig_port_ioctl(pd, cmd, arg);
+
+	init_completion(&work.done);
+	spin_lock(&w->lock);
+	list_add_tail(&work.list, &w->queue);
+	spin_unlock(&w->lock);
+	wake_up(&w->wait);
+	wake_up_all(&sd->sched.wait); // thread may be serving during a yield
+	if (wait_for_completion_killable(&work.done)) {
+		WRITE_ONCE(pd->killed, true);
+		wait_for_completion(&work.done);
+		// other threads sharing the file carry on
+		WRITE_ONCE(pd->killed, false);
+	}
+	return work.ret;
+}
+
+// Start the readout thread.  Without it, commands run in the caller.
+void sbig_worker_start(struct sbig_device *sd)
+{
+	struct sbig_worker *w = &sd->worker;
+	struct task_struct *task;
+
+	spin_lock_init(&w->lock);
+	INIT_LIST_HEAD(&w->queue);
+	init_waitqueue_head(&w->wait);
+
+	task = kthread_create(sbig_worker_fn, sd, "sbiglpt%d", sd->minor);
+	if (IS_ERR(task)) {
+		pr_err("sbiglpt%d: readout thread not started (%ld)\n",
+		       sd->minor, PTR_ERR(task));
+		return;
+	}
+	w->task = task;
+	w->cpu = -1;
+	if (sbig_worker_set_cpu(sd, READ_ONCE(readout_cpu)) == 0)
+		w->cpu = READ_ONCE(readout_cpu);
+	if (sbig_worker_set_priority(sd, READ_ONCE(readout_priority)) == 0)
+		w->priority = READ_ONCE(readout_priority);
+	wake_up_process(task);
+}
+
+// Stop the readout thread.  The port must be idle.
+void sbig_worker_stop(struct sbig_device *sd)
+{
+	if (sd->worker.task) {
+		kthread_stop(sd->worker.task);
+		sd->worker.task = NULL;
+	}
+}
+
+static ssize_t readout_cpu_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(sd->worker.cpu));
+}
+
+static ssize_t readout_cpu_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	int val;
+	int rc;
+
+	rc = kstrtoint(buf, 0, &val);
+	if (rc < 0)
+		return rc;
+	if (!sd->worker.task)
+		return -ENODEV;
+	mutex_lock(&sd->lock);
+	rc = sbig_worker_set_cpu(sd, val);
+	if (rc == 0)
+		WRITE_ONCE(sd->worker.cpu, val < 0 ? -1 : val);
+	mutex_unlock(&sd->lock);
+	return rc < 0 ? rc : count;
+}
+static DEVICE_ATTR_RW(readout_cpu);
+
+static ssize_t readout_priority_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 READ_ONCE(sd->worker.priority));
+}
+
+static ssize_t readout_priority_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct sbig_device *sd = dev_get_drvdata(dev);
+	unsigned int val;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &val);
+	if (rc < 0)
+		return rc;
+	if (!sd->worker.task)
+		return -ENODEV;
+	mutex_lock(&sd->lock);
+	rc = sbig_worker_set_priority(sd, val);
+	if (rc == 0)
+		WRITE_ONCE(sd->worker.priority, val);
+	mutex_unlock(&sd->lock);
+	return rc < 0 ? rc : count;
+}
+static DEVICE_ATTR_RW(readout_priority);
+
+static struct attribute *sbig_worker_attrs[] = {
+	&dev_attr_readout_cpu.attr,
+	&dev_attr_readout_priority.attr,
+	NULL,
+};
+
+const struct attribute_group sbig_worker_group = {
+	.attrs = sbig_worker_attrs,
+};
@@ -0,0 +1,402 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* Measure how sbiglpt readouts scale across ports
+ *
+ *	cc -O2 -pthread -I../driver -o sbig-bench sbig-bench.c -lm
+ *	sbig-bench [-w len] [-h height] [-n frames] [-r rois [-s size]]
+ *		/dev/sbiglpt0 ...
+ *	sbig-bench -b [-c camera] [-W width] [-C clear] [-w len] [-h height]
+ *		[-n frames] /dev/sbiglpt0 ...
+ *
+ * For 1 up to all of the devices given, reads n frames of len by height
+ * pixels from each device with IOCTL_GET_AREA, one thread per device,
+ * all at once.  Prints the frame rate of the slowest device and the
+ * total pixel rate, and the speedup over one device.  With no global
+ * serialization in the driver the total grows with the number of ports
+ * until the CPUs or the bus run out.
+ *
+ * With -r, compares IOCTL_GET_ROIS of that many size by size regions,
+ * spread diagonally over the same len by height rows, with
+ * IOCTL_GET_AREA of all of them, on all the devices at once.  Rows on no
+ * region are dumped instead of digitized, and rows on one are only
+ * digitized across the regions on them, so the difference is the
+ * digitizing and PLD clears saved; it shrinks as regions cover more of
+ * the rows.
+ *
+ * With -b, checks merge_clears on bias frames, one device after the
+ * other: clears clear rows of the imaging CCD with IOCTL_CLEAR_IMAG_CCD
+ * and reads the len leftmost pixels of height rows of a width pixel
+ * wide CCD with IOCTL_GET_AREA_STATS, n times with merge_clears off,
+ * then on.  camera is a CAMERA_TYPE of sbigudrv.h, ST-7 by default.
+ * Prints the mean and standard deviation of each in ADU, the difference
+ * of the means in standard errors, and what merged_clears says was
+ * saved.  The shutter must be closed, and the camera cooled and
+ * settled, as dark current drifting between the two runs counts against
+ * the difference.  merge_clears is put back as it was.
+ *
+ * Without cameras, use the simulated ports of simport/sbig_simport.c.
+ * Only the readout is timed, no exposure is started.  Every pixel of a
+ * simulated port reads 0, so -b on one only shows that both modes run.
+ */
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+#include "sbiglpt.h"
+
+#define MAX_DEVS	64
+
+struct bench {
+	const char *path;
+	int fd;
+	int frames;
+	unsigned long cmd;
+	void *req;
+	struct linux_get_area_params lgap;
+	struct sbig_rois rois;
+	pthread_barrier_t *start;
+	uint64_t ns;
+	int status;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *bench_thread(void *arg)
+{
+	struct bench *b = arg;
+	uint64_t t0;
+	int i;
+
+	pthread_barrier_wait(b->start);
+	t0 = now_ns();
+	for (i = 0; i < b->frames; i++) {
+		b->status = ioctl(b->fd, b->cmd, b->req);
+		if (b->status != 0)
+			break;
+	}
+	b->ns = now_ns() - t0;
+	return NULL;
+}
+
+static int bench_open(struct bench *b, int len, int height)
+{
+	__u16 size = len * height * 2;
+
+	b->fd = open(b->path, O_RDWR);
+	if (b->fd < 0) {
+		perror(b->path);
+		return -1;
+	}
+	if (ioctl(b->fd, IOCTL_SET_BUFFER_SIZE, &size) != size) {
+		fprintf(stderr, "%s: can't set buffer size %u\n", b->path,
+			size);
+		return -1;
+	}
+	memset(&b->lgap, 0, sizeof(b->lgap));
+	b->lgap.gap.ccd = CCD_IMAGING;
+	b->lgap.gap.len = len;
+	b->lgap.gap.right = len;
+	b->lgap.gap.horzBin = 1;
+	b->lgap.gap.vertBin = 1;
+	b->lgap.gap.clearWidth = len;
+	b->lgap.gap.height = height;
+	b->lgap.length = size;
+	b->lgap.dest = malloc(size);
+	if (!b->lgap.dest) {
+		perror("malloc");
+		return -1;
+	}
+	b->cmd = IOCTL_GET_AREA;
+	b->req = &b->lgap;
+	return 0;
+}
+
+// Spread count size by size regions from the top left to the bottom right.
+static void bench_rois(struct bench *b, int count, int size)
+{
+	struct sbig_rois *rs = &b->rois;
+	int len = b->lgap.gap.len, height = b->lgap.gap.height;
+	int i, steps = count > 1 ? count - 1 : 1;
+
+	memset(rs, 0, sizeof(*rs));
+	rs->gap = b->lgap.gap;
+	rs->count = count;
+	for (i = 0; i < count; i++) {
+		rs->roi[i].top = i * (height - size) / steps;
+		rs->roi[i].left = i * (len - size) / steps;
+		rs->roi[i].height = size;
+		rs->roi[i].len = size;
+	}
+	rs->dest = b->lgap.dest;
+	rs->length = count * size * size * 2;
+}
+
+// Run n devices at once.  Returns the longest time taken, or 0 on error.
+static uint64_t bench_run(struct bench *b, int n)
+{
+	pthread_t tid[MAX_DEVS];
+	pthread_barrier_t start;
+	uint64_t worst = 0;
+	int i;
+
+	pthread_barrier_init(&start, NULL, n);
+	for (i = 0; i < n; i++) {
+		b[i].start = &start;
+		pthread_create(&tid[i], NULL, bench_thread, &b[i]);
+	}
+	for (i = 0; i < n; i++)
+		pthread_join(tid[i], NULL);
+	pthread_barrier_destroy(&start);
+	for (i = 0; i < n; i++) {
+		if (b[i].status != 0) {
+			fprintf(stderr, "%s: ioctl %lx: %d\n", b[i].path,
+				b[i].cmd, b[i].status);
+			return 0;
+		}
+		if (worst < b[i].ns)
+			worst = b[i].ns;
+	}
+	return worst;
+}
+
+// Read or write attr of the sysfs device of b, without the newline.
+static int bench_attr(struct bench *b, const char *attr, char *val,
+		      size_t size, int write)
+{
+	char path[256], dev[64];
+	ssize_t n;
+	int fd;
+
+	snprintf(dev, sizeof(dev), "%s", b->path);
+	snprintf(path, sizeof(path), "/sys/class/sbiglpt/%s/%s",
+		 basename(dev), attr);
+	fd = open(path, write ? O_WRONLY : O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	n = write ? pwrite(fd, val, strlen(val), 0) : read(fd, val, size - 1);
+	close(fd);
+	if (n < 0) {
+		perror(path);
+		return -1;
+	}
+	if (!write) {
+		val[n] = 0;
+		val[strcspn(val, "\n")] = 0;
+	}
+	return 0;
+}
+
+// Clear and read n bias frames, averaging their means and variances.
+static int bench_bias_run(struct bench *b, struct ioc_clear_ccd_params *cp,
+			  double *mean, double *sd, uint64_t *pixels)
+{
+	struct sbig_area_stats as;
+	double m = 0, v = 0;
+	int i, rc;
+
+	*pixels = 0;
+	for (i = 0; i < b->frames; i++) {
+		rc = ioctl(b->fd, IOCTL_CLEAR_IMAG_CCD, cp);
+		if (rc != 0) {
+			fprintf(stderr, "%s: IOCTL_CLEAR_IMAG_CCD: %d\n",
+				b->path, rc);
+			return -1;
+		}
+		memset(&as, 0, sizeof(as));
+		as.gap = b->lgap.gap;
+		rc = ioctl(b->fd, IOCTL_GET_AREA_STATS, &as);
+		if (rc != 0) {
+			fprintf(stderr, "%s: IOCTL_GET_AREA_STATS: %d\n",
+				b->path, rc);
+			return -1;
+		}
+		m += as.mean / 100.0;
+		v += (as.sd / 100.0) * (as.sd / 100.0);
+		*pixels += as.pixels;
+	}
+	*mean = m / b->frames;
+	*sd = sqrt(v / b->frames);
+	return 0;
+}
+
+// Compare bias frames read with merge_clears off and on.
+static int bench_bias(struct bench *b, int camera, int width, int clear)
+{
+	struct ioc_clear_ccd_params cp = {
+		.cameraID = camera,
+		.height = clear,
+		.times = 1,
+	};
+	double mean[2], sd[2], se;
+	uint64_t pixels[2];
+	char old[32], merged[256];
+	int on, rc = 0;
+
+	b->lgap.gap.cameraID = camera;
+	b->lgap.gap.clearWidth = width;
+	b->lgap.gap.right = width - b->lgap.gap.len;
+	if (bench_attr(b, "merge_clears", old, sizeof(old), 0) < 0)
+		return -1;
+	for (on = 0; on < 2 && rc == 0; on++) {
+		rc = bench_attr(b, "merge_clears", on ? "1" : "0", 0, 1);
+		if (rc == 0)
+			rc = bench_bias_run(b, &cp, &mean[on], &sd[on],
+					    &pixels[on]);
+	}
+	if (rc == 0)
+		rc = bench_attr(b, "merged_clears", merged, sizeof(merged), 0);
+	if (bench_attr(b, "merge_clears", old, 0, 1) < 0 || rc < 0)
+		return -1;
+
+	// standard error of the difference of the two means
+	se = sqrt(sd[0] * sd[0] / pixels[0] + sd[1] * sd[1] / pixels[1]);
+	printf("%s: merge_clears off mean %.2f sd %.2f\n", b->path, mean[0],
+	       sd[0]);
+	printf("%s: merge_clears on mean %.2f sd %.2f\n", b->path, mean[1],
+	       sd[1]);
+	printf("%s: difference %.2f standard errors\n", b->path,
+	       se > 0 ? (mean[1] - mean[0]) / se : 0.0);
+	printf("%s: merged_clears %s\n", b->path, merged);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: sbig-bench [-w len] [-h height] [-n frames] [-r rois [-s size]] device...\n"
+		"       sbig-bench -b [-c camera] [-W width] [-C clear] [-w len] [-h height] [-n frames] device...\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct bench b[MAX_DEVS];
+	int len = 512, height = 32, frames = 20, rois = 0, size = 8;
+	int bias = 0, camera = 4, width = 0, clear = 0;	// ST7_CAMERA
+	int ndevs, n, i, c;
+	double fps, rate, base = 0, area_fps;
+	uint64_t worst;
+
+	while ((c = getopt(argc, argv, "w:h:n:r:s:bc:W:C:")) != -1) {
+		switch (c) {
+		case 'w':
+			len = atoi(optarg);
+			break;
+		case 'h':
+			height = atoi(optarg);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'r':
+			rois = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'b':
+			bias = 1;
+			break;
+		case 'c':
+			camera = atoi(optarg);
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'C':
+			clear = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	ndevs = argc - optind;
+	if (ndevs < 1 || ndevs > MAX_DEVS || len < 1 || height < 1 ||
+	    frames < 1)
+		usage();
+	if ((long)len * height * 2 > 0xffff) {
+		fprintf(stderr, "len * height must fit a %u byte buffer\n",
+			0xffff);
+		return 1;
+	}
+	// the regions and a row go in the buffer of a whole frame
+	if (rois < 0 || rois > SBIG_ROIS_MAX || size < 1 || size > len ||
+	    size > height || rois * size * size + len > len * height) {
+		fprintf(stderr, "up to %d regions must fit the frame\n",
+			SBIG_ROIS_MAX);
+		return 1;
+	}
+	for (i = 0; i < ndevs; i++) {
+		b[i].path = argv[optind + i];
+		b[i].frames = frames;
+		if (bench_open(&b[i], len, height) < 0)
+			return 1;
+		if (rois)
+			bench_rois(&b[i], rois, size);
+	}
+
+	if (bias) {
+		if (width == 0)
+			width = 2 * len;
+		if (clear == 0)
+			clear = height;
+		if (width < len || width > 0x7fff || clear > 0x7fff) {
+			fprintf(stderr, "len must fit in width\n");
+			return 1;
+		}
+		for (i = 0; i < ndevs; i++)
+			if (bench_bias(&b[i], camera, width, clear) < 0)
+				return 1;
+		return 0;
+	}
+
+	if (rois) {
+		worst = bench_run(b, ndevs);
+		if (!worst)
+			return 1;
+		area_fps = frames * 1e9 / worst;
+		for (i = 0; i < ndevs; i++) {
+			b[i].cmd = IOCTL_GET_ROIS;
+			b[i].req = &b[i].rois;
+		}
+		worst = bench_run(b, ndevs);
+		if (!worst)
+			return 1;
+		fps = frames * 1e9 / worst;
+		printf("ports area-frames/s rois-frames/s speedup\n");
+		printf("%d %.1f %.1f %.2f\n", ndevs, area_fps, fps,
+		       fps / area_fps);
+		return 0;
+	}
+
+	printf("ports frames/s pixels/s speedup\n");
+	for (n = 1; n <= ndevs; n++) {
+		worst = bench_run(b, n);
+		if (!worst)
+			return 1;
+		fps = frames * 1e9 / worst;
+		rate = fps * n * len * height;
+		if (n == 1)
+			base = rate;
+		printf("%d %.1f %.0f %.2f\n", n, fps, rate, rate / base);
+	}
+	return 0;
+}
@@ -0,0 +1,282 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* Replay a sbiglpt flight recorder capture against a mock parallel port
+ *
+ *	cc -O2 -o sbig-replay sbig-replay.c
+ *	sbig-replay [-g gaps] [-n passes] [-t io_ns] trace.txt
+ *
+ * The capture comes from /sys/kernel/debug/sbiglpt/sbiglptN/recorder,
+ * see driver/recorder.c.  Writes are fed to a mock port that latches
+ * camera registers on the strobe like the camera does, and reads return
+ * what the camera answered at the time, so the exact sequence can be
+ * studied and timed without the camera.
+ *
+ * Shows where the time went by operation and command, the longest gaps
+ * between accesses, the longest runs of identical reads (busy polls),
+ * and camera register writes.  -t estimates how long the sequence would
+ * take at io_ns per access, and -n times passes over the mock port, the
+ * floor for any port backend.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_OPS		8
+#define MAX_CMDS	256
+#define MAX_GAPS	64
+
+struct access {
+	uint64_t ns;
+	int write;
+	uint8_t data;
+	int op;
+	int cmd;
+};
+
+struct mock_port {
+	uint8_t data;		// last written
+	uint8_t reg[8];		// camera output registers by address >> 4
+	uint64_t latches[8];
+	const struct access *next_read;
+	void (*write_data)(struct mock_port *mp, uint8_t d);
+	uint8_t (*read_status)(struct mock_port *mp);
+};
+
+static char op_names[MAX_OPS][16];
+static int nops;
+
+static int op_index(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nops; i++) {
+		if (strcmp(op_names[i], name) == 0)
+			return i;
+	}
+	if (nops == MAX_OPS)
+		return MAX_OPS - 1;
+	snprintf(op_names[nops], sizeof(op_names[nops]), "%s", name);
+	return nops++;
+}
+
+// Camera registers are latched as bit 7 (the strobe) goes high.
+static void mock_write_data(struct mock_port *mp, uint8_t d)
+{
+	if ((d & 0x80) && !(mp->data & 0x80)) {
+		mp->reg[(d >> 4) & 7] = d & 0x0f;
+		mp->latches[(d >> 4) & 7]++;
+	}
+	mp->data = d;
+}
+
+static uint8_t mock_read_status(struct mock_port *mp)
+{
+	return mp->next_read ? mp->next_read->data : 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct access *load(FILE *f, size_t *count)
+{
+	struct access *a = NULL;
+	size_t n = 0, max = 0;
+	char line[256], dir, op[16];
+	unsigned long long ns;
+	unsigned int data, cmd;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#') {
+			fputs(line, stdout);
+			continue;
+		}
+		if (sscanf(line, "%llu %c %x %15s %u", &ns, &dir, &data, op,
+			   &cmd) != 5)
+			continue;
+		if (n == max) {
+			max = max ? max * 2 : 65536;
+			a = realloc(a, max * sizeof(*a));
+			if (!a) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		a[n].ns = ns;
+		a[n].write = dir == 'w';
+		a[n].data = data;
+		a[n].op = op_index(op);
+		a[n].cmd = cmd % MAX_CMDS;
+		n++;
+	}
+	*count = n;
+	return a;
+}
+
+static void replay(struct mock_port *mp, const struct access *a, size_t n)
+{
+	size_t i;
+	volatile uint8_t sink;
+
+	for (i = 0; i < n; i++) {
+		if (a[i].write) {
+			mp->write_data(mp, a[i].data);
+		} else {
+			mp->next_read = &a[i];
+			sink = mp->read_status(mp);
+		}
+	}
+	(void)sink;
+}
+
+static int gap_cmp(const void *x, const void *y)
+{
+	const uint64_t *a = x, *b = y;
+
+	return a[0] < b[0] ? 1 : a[0] > b[0] ? -1 : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: sbig-replay [-g gaps] [-n passes] [-t io_ns] trace\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct mock_port mp = {
+		.write_data = mock_write_data,
+		.read_status = mock_read_status,
+	};
+	uint64_t op_ns[MAX_OPS] = { 0 }, op_w[MAX_OPS] = { 0 };
+	uint64_t op_r[MAX_OPS] = { 0 };
+	uint64_t cmd_ns[MAX_CMDS] = { 0 }, cmd_n[MAX_CMDS] = { 0 };
+	uint64_t (*gaps)[2], span, t0, dt;
+	size_t n, i, run = 0, best_run = 0, best_at = 0;
+	int ngaps = 10, passes = 0, io_ns = 0, c, p;
+	struct access *a;
+	FILE *f;
+
+	while ((c = getopt(argc, argv, "g:n:t:")) != -1) {
+		switch (c) {
+		case 'g':
+			ngaps = atoi(optarg);
+			break;
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		case 't':
+			io_ns = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+	f = fopen(argv[optind], "r");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	a = load(f, &n);
+	fclose(f);
+	if (n < 2) {
+		fprintf(stderr, "%s: no accesses\n", argv[optind]);
+		return 1;
+	}
+	if (ngaps > MAX_GAPS)
+		ngaps = MAX_GAPS;
+
+	// time between accesses is charged to the later one
+	gaps = calloc(n, sizeof(*gaps));
+	if (!gaps) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		dt = i ? a[i].ns - a[i - 1].ns : 0;
+		op_ns[a[i].op] += dt;
+		cmd_ns[a[i].cmd] += dt;
+		cmd_n[a[i].cmd]++;
+		if (a[i].write)
+			op_w[a[i].op]++;
+		else
+			op_r[a[i].op]++;
+		gaps[i][0] = dt;
+		gaps[i][1] = i;
+		if (!a[i].write && i && !a[i - 1].write &&
+		    a[i].data == a[i - 1].data) {
+			if (++run > best_run) {
+				best_run = run;
+				best_at = i - run;
+			}
+		} else {
+			run = 0;
+		}
+	}
+	span = a[n - 1].ns - a[0].ns;
+	printf("accesses %zu span_ns %llu avg_ns %llu\n", n,
+	       (unsigned long long)span,
+	       (unsigned long long)(span / (n - 1)));
+
+	for (p = 0; p < nops; p++)
+		printf("op %s writes %llu reads %llu ns %llu\n", op_names[p],
+		       (unsigned long long)op_w[p],
+		       (unsigned long long)op_r[p],
+		       (unsigned long long)op_ns[p]);
+	for (c = 0; c < MAX_CMDS; c++) {
+		if (cmd_n[c])
+			printf("cmd %d accesses %llu ns %llu\n", c,
+			       (unsigned long long)cmd_n[c],
+			       (unsigned long long)cmd_ns[c]);
+	}
+
+	qsort(gaps, n, sizeof(*gaps), gap_cmp);
+	for (i = 0; i < (size_t)ngaps && i < n && gaps[i][0]; i++) {
+		const struct access *g = &a[gaps[i][1]];
+
+		printf("gap %llu ns before #%llu %c 0x%02x %s cmd %d\n",
+		       (unsigned long long)gaps[i][0],
+		       (unsigned long long)gaps[i][1], g->write ? 'w' : 'r',
+		       g->data, op_names[g->op], g->cmd);
+	}
+	if (best_run)
+		printf("poll run %zu reads of 0x%02x from #%zu\n", best_run + 1,
+		       a[best_at].data, best_at);
+
+	replay(&mp, a, n);
+	for (c = 0; c < 8; c++) {
+		if (mp.latches[c])
+			printf("reg 0x%02x latched %llu last 0x%x\n", c << 4,
+			       (unsigned long long)mp.latches[c], mp.reg[c]);
+	}
+
+	if (io_ns > 0)
+		printf("at %d ns per access: %llu ns, %llu%% of recorded\n",
+		       io_ns, (unsigned long long)n * io_ns,
+		       (unsigned long long)(span ?
+				n * io_ns * 100 / span : 0));
+	if (passes > 0) {
+		t0 = now_ns();
+		for (p = 0; p < passes; p++)
+			replay(&mp, a, n);
+		dt = now_ns() - t0;
+		printf("mock replay %d passes ns per access %llu.%02llu\n",
+		       passes,
+		       (unsigned long long)(dt / passes / n),
+		       (unsigned long long)(dt * 100 / passes / n % 100));
+	}
+	free(gaps);
+	free(a);
+	return 0;
+}
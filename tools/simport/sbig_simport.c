@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* Simulated parallel ports for benchmarking sbiglpt without cameras
+ *
+ *	make && insmod sbig_simport.ko ports=4 io_ns=1000
+ *
+ * Registers that many parallel ports with the parport core, which
+ * sbiglpt attaches to like any other, so /dev/sbiglptN appears for each.
+ * Every port access takes io_ns, about what an inb() or outb() of a PC
+ * parallel port costs, and reads of the status register return 0: the
+ * PLD and the A/D are always ready and every pixel reads 0.  The micro
+ * handshake is never answered, so only readout commands such as
+ * IOCTL_GET_AREA and IOCTL_GET_ROIS work; see tools/sbig-bench.c.
+ *
+ * sbiglpt may be loaded before or after.  The IEEE 1284 probe of the
+ * parport core times out on each port as it would on a port with nothing
+ * plugged in.
+ */
+
+#include <linux/delay.h>
+#include <linux/module.h>
+#include <linux/parport.h>
+
+#define SIMPORT_MAX	16
+
+static unsigned int ports = 4;
+module_param(ports, uint, 0444);
+MODULE_PARM_DESC(ports, "Number of simulated ports (max 16)");
+
+static unsigned int io_ns = 1000;
+module_param(io_ns, uint, 0644);
+MODULE_PARM_DESC(io_ns, "Cost of each port access (nsec)");
+
+struct simport {
+	unsigned char data;
+	unsigned char control;
+};
+
+static struct parport *simport_ports[SIMPORT_MAX];
+static struct simport simport_state[SIMPORT_MAX];
+
+static void simport_io(void)
+{
+	unsigned int ns = READ_ONCE(io_ns);
+
+	if (ns)
+		ndelay(ns);
+}
+
+static void simport_write_data(struct parport *p, unsigned char d)
+{
+	struct simport *sp = p->private_data;
+
+	simport_io();
+	sp->data = d;
+}
+
+static unsigned char simport_read_data(struct parport *p)
+{
+	struct simport *sp = p->private_data;
+
+	simport_io();
+	return sp->data;
+}
+
+static void simport_write_control(struct parport *p, unsigned char d)
+{
+	struct simport *sp = p->private_data;
+
+	simport_io();
+	sp->control = d;
+}
+
+static unsigned char simport_read_control(struct parport *p)
+{
+	struct simport *sp = p->private_data;
+
+	simport_io();
+	return sp->control;
+}
+
+static unsigned char simport_frob_control(struct parport *p,
+					  unsigned char mask,
+					  unsigned char val)
+{
+	struct simport *sp = p->private_data;
+
+	simport_io();
+	sp->control = (sp->control & ~mask) ^ val;
+	return sp->control;
+}
+
+// nothing plugged in but an idle camera
+static unsigned char simport_read_status(struct parport *p)
+{
+	simport_io();
+	return 0;
+}
+
+static void simport_nop(struct parport *p)
+{
+}
+
+static void simport_init_state(struct pardevice *dev, struct parport_state *s)
+{
+}
+
+static void simport_save_restore_state(struct parport *p,
+				       struct parport_state *s)
+{
+}
+
+static struct parport_operations simport_ops = {
+	.write_data	= simport_write_data,
+	.read_data	= simport_read_data,
+
+	.write_control	= simport_write_control,
+	.read_control	= simport_read_control,
+	.frob_control	= simport_frob_control,
+
+	.read_status	= simport_read_status,
+
+	.enable_irq	= simport_nop,
+	.disable_irq	= simport_nop,
+
+	.data_forward	= simport_nop,
+	.data_reverse	= simport_nop,
+
+	.init_state	= simport_init_state,
+	.save_state	= simport_save_restore_state,
+	.restore_state	= simport_save_restore_state,
+
+	.epp_write_data	= parport_ieee1284_epp_write_data,
+	.epp_read_data	= parport_ieee1284_epp_read_data,
+	.epp_write_addr	= parport_ieee1284_epp_write_addr,
+	.epp_read_addr	= parport_ieee1284_epp_read_addr,
+
+	.ecp_write_data	= parport_ieee1284_ecp_write_data,
+	.ecp_read_data	= parport_ieee1284_ecp_read_data,
+	.ecp_write_addr	= parport_ieee1284_ecp_write_addr,
+
+	.compat_write_data	= parport_ieee1284_write_compat,
+	.nibble_read_data	= parport_ieee1284_read_nibble,
+	.byte_read_data		= parport_ieee1284_read_byte,
+
+	.owner		= THIS_MODULE,
+};
+
+static void simport_remove(void)
+{
+	int i;
+
+	for (i = 0; i < SIMPORT_MAX; i++) {
+		if (!simport_ports[i])
+			continue;
+		parport_remove_port(simport_ports[i]);
+		parport_put_port(simport_ports[i]);
+		simport_ports[i] = NULL;
+	}
+}
+
+static int __init simport_init(void)
+{
+	struct parport *p;
+	unsigned int i;
+
+	if (ports == 0 || ports > SIMPORT_MAX)
+		return -EINVAL;
+	for (i = 0; i < ports; i++) {
+		p = parport_register_port(0, PARPORT_IRQ_NONE, PARPORT_DMA_NONE,
+					  &simport_ops);
+		if (!p) {
+			simport_remove();
+			return -ENOMEM;
+		}
+		p->modes = PARPORT_MODE_PCSPP;
+		p->private_data = &simport_state[i];
+		simport_ports[i] = p;
+		parport_announce_port(p);
+	}
+	pr_info("sbig_simport: %u ports, %u ns per access\n", ports, io_ns);
+	return 0;
+}
+
+static void __exit simport_exit(void)
+{
+	simport_remove();
+}
+
+module_init(simport_init);
+module_exit(simport_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Simulated parallel ports for benchmarking sbiglpt");